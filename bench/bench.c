@@ -0,0 +1,456 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Benchmarks for ctodo. Synthetic lists are generated in memory and parsed,
+ * converted back to strings, saved, drawn, deleted and loaded from a temporary
+ * file.
+ * Each result is printed as a JSON object on a line of its own, so results
+ * from different versions can be compared by scripts.
+ *
+ * Allocations are counted when the benchmark is linked with malloc(),
+ * calloc(), realloc() and free() wrapped (see CMakeLists.txt), and are
+ * reported as null otherwise. The peak resident set size is that of the whole
+ * process so far, so lists are benchmarked in order of increasing size. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "task.h"
+#include "file.h"
+#include "stream.h"
+#include "writer.h"
+#include "error.h"
+
+/* Default numbers of tasks in generated lists. */
+#define DEFAULT_TASKS "1000,10000,100000,1000000"
+
+/* Parameters of generated lists. */
+typedef struct PARAMS {
+  size_t tasks; /* Number of tasks. */
+  size_t message_length; /* Average length of messages in bytes. */
+  double done_ratio; /* Ratio of tasks that are done. */
+  size_t options; /* Number of options. */
+  int utf8; /* Whether messages contain non-ASCII characters. */
+  unsigned long seed; /* Seed of random number generator. */
+} PARAMS;
+
+/* Words used in messages. */
+static const char *ascii_words[] = {
+  "buy", "milk", "call", "fix", "the", "bug", "in", "parser", "write",
+  "report", "review", "patch", "release", "notes", "for", "version", "clean",
+  "kitchen", "book", "flight", "to", "Copenhagen"
+};
+static const char *utf8_words[] = {
+  "købe", "mælk", "Ærø", "übergröße", "café", "naïve", "日本語", "テスト",
+  "задача", "проверить", "κόσμε", "✓", "😀"
+};
+
+#ifdef COUNT_ALLOCATIONS
+/* Calls to the allocation functions, counted by the wrappers below. */
+static volatile unsigned long allocations = 0;
+static volatile unsigned long frees = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+  __sync_fetch_and_add(&allocations, 1);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  __sync_fetch_and_add(&allocations, 1);
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  __sync_fetch_and_add(&allocations, 1);
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr) {
+    __sync_fetch_and_add(&frees, 1);
+  }
+  __real_free(ptr);
+}
+#endif
+
+/* Measurement of an operation. */
+typedef struct MEASUREMENT {
+  double start; /* Time at start. */
+  unsigned long allocations; /* Allocations at start. */
+  unsigned long frees; /* Frees at start. */
+} MEASUREMENT;
+
+/* Get the current time in seconds. */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void start_measurement(MEASUREMENT *m) {
+#ifdef COUNT_ALLOCATIONS
+  m->allocations = allocations;
+  m->frees = frees;
+#endif
+  m->start = now();
+}
+
+/* Print the result of an operation on a list. */
+static void report(const char *operation, PARAMS *params, size_t bytes,
+    MEASUREMENT *m, int cached) {
+  double seconds = now() - m->start;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("{\"benchmark\": \"list\", \"version\": \"%s\", \"operation\": \"%s\", "
+      "\"tasks\": %lu, \"message_length\": %lu, \"done_ratio\": %.3f, "
+      "\"options\": %lu, \"utf8\": %s, \"bytes\": %lu, ",
+      CTODO_VERSION, operation, (unsigned long)params->tasks,
+      (unsigned long)params->message_length, params->done_ratio,
+      (unsigned long)params->options, params->utf8 ? "true" : "false",
+      (unsigned long)bytes);
+  if (cached >= 0) {
+    printf("\"cached\": %s, ", cached ? "true" : "false");
+  }
+  printf("\"seconds\": %.6f, \"mb_per_second\": %.2f, "
+      "\"tasks_per_second\": %.0f, ",
+      seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+      seconds > 0 ? params->tasks / seconds : 0.0);
+#ifdef COUNT_ALLOCATIONS
+  printf("\"allocations\": %lu, \"frees\": %lu, ", allocations - m->allocations,
+      frees - m->frees);
+#else
+  printf("\"allocations\": null, \"frees\": null, ");
+#endif
+  /* ru_maxrss is in kilobytes on Linux and in bytes on macOS. */
+#ifdef __APPLE__
+  printf("\"peak_rss_kb\": %ld}\n", usage.ru_maxrss / 1024);
+#else
+  printf("\"peak_rss_kb\": %ld}\n", usage.ru_maxrss);
+#endif
+  fflush(stdout);
+}
+
+/* A simple random number generator (xorshift), so lists are the same on all
+ * platforms. */
+static unsigned long next_random(unsigned long *state) {
+  unsigned long x = *state;
+  x ^= (x << 13) & 0xffffffffUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xffffffffUL;
+  *state = x & 0xffffffffUL;
+  return *state;
+}
+
+/* Write a message of about the given length. Words are never split, so UTF-8
+ * sequences are always complete. */
+static void write_message(STREAM *output, PARAMS *params, unsigned long *state) {
+  size_t target = params->message_length / 2 + 1;
+  size_t length = 0;
+  const char *word = NULL;
+  target += next_random(state) % (params->message_length + 1);
+  while (length < target) {
+    if (params->utf8 && next_random(state) % 3 == 0) {
+      word = utf8_words[next_random(state)
+        % (sizeof(utf8_words) / sizeof(utf8_words[0]))];
+    }
+    else {
+      word = ascii_words[next_random(state)
+        % (sizeof(ascii_words) / sizeof(ascii_words[0]))];
+    }
+    if (length > 0) {
+      stream_putc(' ', output);
+      length++;
+    }
+    stream_write(word, 1, strlen(word), output);
+    length += strlen(word);
+  }
+}
+
+/* Generate the content of a list file. */
+static char *generate_list(PARAMS *params, size_t *length) {
+  STREAM *output = stream_new_buffer(params->tasks
+      * (params->message_length + 8) + 4096);
+  unsigned long state = params->seed ? params->seed : 1;
+  size_t i;
+  if (!output) {
+    return NULL;
+  }
+  stream_printf(output, "Benchmark\n");
+  for (i = 0; i < params->tasks; i++) {
+    if ((next_random(&state) % 1000) < params->done_ratio * 1000) {
+      stream_write("[X] ", 1, 4, output);
+    }
+    else {
+      stream_write("[ ] ", 1, 4, output);
+    }
+    write_message(output, params, &state);
+    stream_putc('\n', output);
+  }
+  for (i = 0; i < params->options; i++) {
+    stream_printf(output, "%s option%lu=value%lu%s", i % 8 ? "" : "#",
+        (unsigned long)i, (unsigned long)i,
+        i % 8 == 7 || i + 1 == params->options ? "\n" : "");
+  }
+  return stream_close_buffer(output, length);
+}
+
+/* Number of rows drawn by each simulated redraw. */
+#define REDRAW_ROWS 40
+/* Number of simulated redraws. */
+#define REDRAWS 100000
+
+/* Time what ctodo does to draw the screen after a keypress: count the shown
+ * tasks, find the first task on the screen and step through the rest of the
+ * rows. The screen is scrolled down a task at a time. If hide_done is set, the
+ * done tasks are hidden first (and shown again afterwards), as by a filter. */
+static void bench_redraw(TODOLIST *list, PARAMS *params, int hide_done) {
+  TASK *task = NULL;
+  size_t i, shown, top, row, rows = 0;
+  double seconds;
+  for (task = list->first; hide_done && task; task = task->next) {
+    set_task_hidden(list, task, task->done);
+  }
+  /* The index is built when it is first needed. */
+  get_shown_task(list, ORDER_LIST, 0);
+  seconds = now();
+  for (i = 0; i < REDRAWS; i++) {
+    shown = get_shown_position(list, ORDER_LIST, NULL);
+    top = shown > REDRAW_ROWS ? i % (shown - REDRAW_ROWS) : 0;
+    task = get_shown_task(list, ORDER_LIST, top);
+    for (row = 0; task && row < REDRAW_ROWS; row++) {
+      task = find_shown_task(list, ORDER_LIST, task, 1);
+      rows++;
+    }
+  }
+  seconds = now() - seconds;
+  printf("{\"benchmark\": \"redraw\", \"version\": \"%s\", \"tasks\": %lu, "
+      "\"hidden\": %lu, \"rows\": %d, \"redraws\": %d, \"seconds\": %.6f, "
+      "\"microseconds_per_redraw\": %.3f, \"rows_drawn\": %lu}\n",
+      CTODO_VERSION, (unsigned long)params->tasks,
+      (unsigned long)list->hidden_count, REDRAW_ROWS, REDRAWS, seconds,
+      seconds / REDRAWS * 1e6, (unsigned long)rows);
+  fflush(stdout);
+  for (task = list->first; hide_done && task; task = task->next) {
+    set_task_hidden(list, task, 0);
+  }
+}
+
+/* Benchmark the operations on a generated list. Returns 0 on error. */
+static int bench_list(PARAMS *params, const char *dir) {
+  MEASUREMENT m;
+  TODOLIST *list = NULL;
+  size_t length = 0;
+  char *source = NULL;
+  char *output = NULL;
+  char *filename = NULL;
+  char *cache = NULL;
+  int fd, i, cached;
+  int status = 1;
+  source = generate_list(params, &length);
+  filename = string_printf("%s/ctodo-bench-XXXXXX", dir);
+  if (!source || !filename || (fd = mkstemp(filename)) < 0) {
+    free(source);
+    free(filename);
+    return 0;
+  }
+  close(fd);
+  cache = string_printf("%s.ctodo-cache", filename);
+
+  start_measurement(&m);
+  list = parse_todolist(source, length);
+  report("parse_todolist", params, length, &m, -1);
+  free(source);
+  if (!list) {
+    unlink(filename);
+    free(filename);
+    free(cache);
+    return 0;
+  }
+
+  start_measurement(&m);
+  output = stringify_todolist(list);
+  report("stringify_todolist", params, length, &m, -1);
+  free(output);
+
+  start_measurement(&m);
+  save_todolist(list, filename);
+  report("save_todolist", params, length, &m, -1);
+
+  bench_redraw(list, params, 0);
+  bench_redraw(list, params, 1);
+
+  start_measurement(&m);
+  delete_todolist(list);
+  report("delete_todolist", params, length, &m, -1);
+
+  /* The file is loaded twice, since large lists are loaded from a snapshot
+   * once it has been written by the first load. */
+  for (i = 0; i < 2 && status; i++) {
+    cached = access(cache, F_OK) == 0;
+    start_measurement(&m);
+    list = load_todolist(filename);
+    report("load_todolist", params, length, &m, cached);
+    if (list) {
+      delete_todolist(list);
+    }
+    else {
+      status = 0;
+    }
+    stop_writer();
+  }
+
+  unlink(filename);
+  unlink(cache);
+  free(filename);
+  free(cache);
+  return status;
+}
+
+/* Time setting, parsing and looking up a number of options. */
+static int bench_options(size_t count) {
+  TODOLIST *list = new_todolist(string_printf("Options"));
+  TODOLIST *parsed = NULL;
+  char key[32];
+  char value[32];
+  char *source = NULL;
+  double set_time, parse_time, lookup_time;
+  size_t i, found = 0;
+  if (!list) {
+    return 0;
+  }
+  set_time = now();
+  for (i = 0; i < count; i++) {
+    sprintf(key, "key%lu", (unsigned long)i);
+    sprintf(value, "value%lu", (unsigned long)i);
+    set_option(list, key, value);
+  }
+  set_time = now() - set_time;
+  source = stringify_todolist(list);
+  delete_todolist(list);
+  if (!source) {
+    return 0;
+  }
+  parse_time = now();
+  parsed = parse_todolist(source, strlen(source));
+  parse_time = now() - parse_time;
+  free(source);
+  if (!parsed) {
+    return 0;
+  }
+  lookup_time = now();
+  for (i = 0; i < count; i++) {
+    sprintf(key, "key%lu", (unsigned long)i);
+    if (get_option(parsed, key)) {
+      found++;
+    }
+  }
+  lookup_time = now() - lookup_time;
+  delete_todolist(parsed);
+  printf("{\"benchmark\": \"options\", \"version\": \"%s\", \"options\": %lu, "
+      "\"set_seconds\": %.6f, \"parse_seconds\": %.6f, "
+      "\"lookup_seconds\": %.6f}\n",
+      CTODO_VERSION, (unsigned long)count, set_time, parse_time, lookup_time);
+  fflush(stdout);
+  return found == count;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-t TASKS[,TASKS...]] [-m LENGTH] [-d RATIO] "
+      "[-o OPTIONS] [-u] [-s SEED] [-b BENCHMARKS] [-D DIR]\n"
+      "  -t  numbers of tasks in generated lists (default " DEFAULT_TASKS ")\n"
+      "  -m  average length of messages in bytes (default 40)\n"
+      "  -d  ratio of tasks that are done (default 0.5)\n"
+      "  -o  number of options in generated lists (default 10)\n"
+      "  -u  include non-ASCII UTF-8 characters in messages\n"
+      "  -s  random seed (default 1)\n"
+      "  -b  benchmarks to run: list, options or list,options (default)\n"
+      "  -D  directory for temporary files (default $TMPDIR or /tmp)\n",
+      name);
+}
+
+int main(int argc, char *argv[]) {
+  PARAMS params;
+  const char *tasks = DEFAULT_TASKS;
+  const char *benchmarks = "list,options";
+  const char *dir = getenv("TMPDIR");
+  char *end = NULL;
+  size_t count;
+  int opt;
+  params.message_length = 40;
+  params.done_ratio = 0.5;
+  params.options = 10;
+  params.utf8 = 0;
+  params.seed = 1;
+  if (!dir || !*dir) {
+    dir = "/tmp";
+  }
+  while ((opt = getopt(argc, argv, "t:m:d:o:us:b:D:h")) != -1) {
+    switch (opt) {
+      case 't':
+        tasks = optarg;
+        break;
+      case 'm':
+        params.message_length = strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        params.done_ratio = strtod(optarg, NULL);
+        break;
+      case 'o':
+        params.options = strtoul(optarg, NULL, 10);
+        break;
+      case 'u':
+        params.utf8 = 1;
+        break;
+      case 's':
+        params.seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'b':
+        benchmarks = optarg;
+        break;
+      case 'D':
+        dir = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (strstr(benchmarks, "list")) {
+    while (*tasks) {
+      params.tasks = strtoul(tasks, &end, 10);
+      if (end == tasks) {
+        usage(argv[0]);
+        return 1;
+      }
+      if (!bench_list(&params, dir)) {
+        fprintf(stderr, "list benchmark failed: %s\n",
+            has_error() ? get_last_error() : "out of memory");
+        return 1;
+      }
+      tasks = *end == ',' ? end + 1 : end;
+    }
+  }
+  if (strstr(benchmarks, "options")) {
+    for (count = 1000; count <= 64000; count *= 4) {
+      if (!bench_options(count)) {
+        fprintf(stderr, "options benchmark failed\n");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,220 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <string.h>
+
+#include "arena.h"
+
+/* Size of the first block of an arena. */
+#define ARENA_MIN_BLOCK 4096
+/* Size at which blocks stop growing. */
+#define ARENA_MAX_BLOCK (1024 * 1024)
+/* Alignment of allocations. */
+#define ARENA_ALIGN 16
+
+struct ARENA_BLOCK {
+  struct ARENA_BLOCK *next; /* Next (older) block. */
+  size_t size; /* Usable size of block. */
+  char *data; /* Start of usable memory. */
+};
+
+/* Round a size up to a multiple of ARENA_ALIGN. */
+static size_t align_size(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void init_arena(ARENA *arena) {
+  arena->blocks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->sorted = NULL;
+  arena->block_count = 0;
+  arena->sorted_capacity = 0;
+}
+
+/* Allocate a block of at least the given size. */
+static ARENA_BLOCK *new_block(size_t size) {
+  size_t header = align_size(sizeof(ARENA_BLOCK));
+  ARENA_BLOCK *block = (ARENA_BLOCK *)malloc(header + size);
+  if (!block) {
+    return NULL;
+  }
+  block->next = NULL;
+  block->size = size;
+  block->data = (char *)block + header;
+  return block;
+}
+
+/* Make room for at least count blocks in the sorted table of an arena. Returns
+ * 0 if there isn't enough memory. */
+static int reserve_blocks(ARENA *arena, size_t count) {
+  size_t capacity = arena->sorted_capacity ? arena->sorted_capacity : 16;
+  ARENA_BLOCK **sorted = NULL;
+  if (count <= arena->sorted_capacity) {
+    return 1;
+  }
+  while (capacity < count) {
+    capacity *= 2;
+  }
+  sorted = (ARENA_BLOCK **)realloc(arena->sorted,
+      capacity * sizeof(ARENA_BLOCK *));
+  if (!sorted) {
+    return 0;
+  }
+  arena->sorted = sorted;
+  arena->sorted_capacity = capacity;
+  return 1;
+}
+
+/* Find the number of blocks in the sorted table of an arena that start at or
+ * before a pointer. */
+static size_t find_block(ARENA *arena, const char *p) {
+  size_t low = 0;
+  size_t high = arena->block_count;
+  size_t middle;
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    if (arena->sorted[middle]->data <= p) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/* Add a new block to the sorted table of an arena, or free it and return NULL
+ * if there isn't enough memory. */
+static ARENA_BLOCK *add_block(ARENA *arena, ARENA_BLOCK *block) {
+  size_t i;
+  if (!reserve_blocks(arena, arena->block_count + 1)) {
+    free(block);
+    return NULL;
+  }
+  i = find_block(arena, block->data);
+  memmove(arena->sorted + i + 1, arena->sorted + i,
+      (arena->block_count - i) * sizeof(ARENA_BLOCK *));
+  arena->sorted[i] = block;
+  arena->block_count++;
+  return block;
+}
+
+void *arena_alloc(ARENA *arena, size_t size) {
+  ARENA_BLOCK *block = NULL;
+  size_t block_size = ARENA_MIN_BLOCK;
+  void *ptr = NULL;
+  size = align_size(size ? size : 1);
+  if (arena->next && size <= (size_t)(arena->end - arena->next)) {
+    ptr = arena->next;
+    arena->next += size;
+    return ptr;
+  }
+  if (arena->blocks) {
+    block_size = arena->blocks->size * 2;
+    if (block_size > ARENA_MAX_BLOCK) {
+      block_size = ARENA_MAX_BLOCK;
+    }
+  }
+  /* Large allocations get a block of their own, which is put behind the
+   * current block so the rest of it can still be used. */
+  if (size > block_size / 2) {
+    block = new_block(size);
+    if (!block || !add_block(arena, block)) {
+      return NULL;
+    }
+    if (arena->blocks) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    }
+    else {
+      arena->blocks = block;
+      arena->next = block->data + size;
+      arena->end = arena->next;
+    }
+    return block->data;
+  }
+  block = new_block(block_size);
+  if (!block || !add_block(arena, block)) {
+    return NULL;
+  }
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->next = block->data + size;
+  arena->end = block->data + block_size;
+  return block->data;
+}
+
+char *arena_copy(ARENA *arena, const char *str, size_t length) {
+  char *copy = (char *)arena_alloc(arena, length + 1);
+  if (!copy) {
+    return NULL;
+  }
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+int arena_contains(ARENA *arena, const void *ptr) {
+  const char *p = (const char *)ptr;
+  size_t i = find_block(arena, p);
+  return i > 0 && p < arena->sorted[i - 1]->data + arena->sorted[i - 1]->size;
+}
+
+int arena_merge(ARENA *arena, ARENA *other) {
+  ARENA_BLOCK **sorted = NULL;
+  ARENA_BLOCK *last = other->blocks;
+  size_t i = 0, j = 0, k = 0;
+  if (!last) {
+    return 1;
+  }
+  sorted = (ARENA_BLOCK **)malloc((arena->block_count + other->block_count)
+      * sizeof(ARENA_BLOCK *));
+  if (!sorted) {
+    return 0;
+  }
+  while (i < arena->block_count || j < other->block_count) {
+    if (j == other->block_count || (i < arena->block_count
+          && arena->sorted[i]->data < other->sorted[j]->data)) {
+      sorted[k++] = arena->sorted[i++];
+    }
+    else {
+      sorted[k++] = other->sorted[j++];
+    }
+  }
+  free(arena->sorted);
+  free(other->sorted);
+  arena->sorted = sorted;
+  arena->block_count = k;
+  arena->sorted_capacity = k;
+  while (last->next) {
+    last = last->next;
+  }
+  /* The blocks of other are put behind the current block of arena. */
+  if (arena->blocks) {
+    last->next = arena->blocks->next;
+    arena->blocks->next = other->blocks;
+  }
+  else {
+    arena->blocks = other->blocks;
+    arena->next = other->next;
+    arena->end = other->end;
+  }
+  init_arena(other);
+  return 1;
+}
+
+void free_arena(ARENA *arena) {
+  ARENA_BLOCK *block = arena->blocks;
+  ARENA_BLOCK *next = NULL;
+  while (block) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena->sorted);
+  init_arena(arena);
+}
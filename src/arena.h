@@ -0,0 +1,43 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* A bump allocator. Memory is allocated from a few large blocks, which grow in
+ * size as the arena grows, and is only released when the whole arena is
+ * freed. The blocks are also kept in order of address, so whether a pointer is
+ * in the arena can be found by binary search. */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+
+typedef struct ARENA_BLOCK ARENA_BLOCK;
+
+/* An arena. */
+typedef struct ARENA {
+  ARENA_BLOCK *blocks; /* Blocks, most recently allocated first. */
+  char *next; /* Next free byte in the first block. */
+  char *end; /* End of the first block. */
+  ARENA_BLOCK **sorted; /* Blocks in order of address. */
+  size_t block_count; /* Number of blocks. */
+  size_t sorted_capacity; /* Number of blocks there is room for in sorted. */
+} ARENA;
+
+/* Initialize an empty arena. */
+void init_arena(ARENA *arena);
+/* Allocate memory suitably aligned for any type. Returns NULL if there isn't
+ * enough memory. */
+void *arena_alloc(ARENA *arena, size_t size);
+/* Copy length bytes of a string followed by a null byte. */
+char *arena_copy(ARENA *arena, const char *str, size_t length);
+/* Whether a pointer points into memory allocated from an arena. */
+int arena_contains(ARENA *arena, const void *ptr);
+/* Move all memory allocated from other into arena, leaving other empty.
+ * Returns 0 and leaves both arenas unchanged if there isn't enough memory. */
+int arena_merge(ARENA *arena, ARENA *other);
+/* Release all memory allocated from an arena, leaving it empty. */
+void free_arena(ARENA *arena);
+
+#endif
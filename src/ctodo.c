@@ -9,7 +9,6 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
-#include <wchar.h>
 #include <locale.h>
 
 #include "config.h"
@@ -17,6 +16,13 @@
 #include "file.h"
 #include "stream.h"
 #include "error.h"
+#include "writer.h"
+#include "journal.h"
+#include "history.h"
+#include "search.h"
+#include "view.h"
+#include "layout.h"
+#include "snapshot.h"
 
 #ifdef READLINE_ENABLE
 #include "wedit.h"
@@ -28,8 +34,19 @@
 #include "sync.h"
 #endif
 
-#define STATUS_SAVED "Saved"
-#define STATUS_UNSAVED "Unsaved"
+/* Save status of the list, which is shown in the top bar. */
+typedef enum {
+  STATUS_SAVED,
+  STATUS_UNSAVED,
+  STATUS_SAVING,
+  STATUS_UNSAVED_SAVING /* Changed while an earlier version is saved. */
+} STATUS;
+
+/* Number of lines read between keystrokes while a list is being loaded. */
+#define LOAD_STEP 20000
+
+/* Time in milliseconds between checks for finished saves. */
+#define SAVE_POLL_INTERVAL 100
 
 COMMAND main_commands[] = {
   {"Q", "Quit"},
@@ -42,45 +59,31 @@ COMMAND main_commands[] = {
   {NULL, NULL}
 };
 
-int print_multiline(int top, int offset, const char *str, size_t max_width) {
-  mbstate_t shift_state;
-  wchar_t wc;
-  size_t x = offset;
-  size_t y = top;
-  size_t wc_len;
-  size_t n = strlen(str);
-  memset(&shift_state, '\0', sizeof shift_state);
-  for (size_t i = 0; i < n; i += wc_len) {
-    wc_len = mbrtowc(&wc, str + i, MB_CUR_MAX, &shift_state);
-    if (!wc_len || wc_len == (size_t)-1 || wc_len == (size_t)-2) {
-      break;
-    }
-    mvprintw(y, x, "%C", wc);
-    size_t new_x, new_y;
-    getyx(stdscr, new_y, new_x);
-    if (new_y > y) {
-      y = new_y;
-      if (new_x > 0) {
-        move(new_y, 0);
-        clrtoeol();
-        mvprintw(y, offset, "%C", wc);
+/* Draw a string at a column of a row, wrapped at max_width columns. The layout
+ * of the string is cached under key (see get_layout()). Returns the number of
+ * rows. */
+int print_multiline(LAYOUTS *layouts, const char *key, int top, int offset,
+    const char *str, int max_width) {
+  const LAYOUT *layout = get_layout(layouts, key, str, max_width);
+  const char *tab = NULL;
+  size_t start, end;
+  int row;
+  if (!layout) {
+    return 1;
+  }
+  for (row = 0; row < layout->rows; row++) {
+    move(top + row, offset);
+    end = layout->starts[row + 1];
+    for (start = layout->starts[row]; start < end; start = tab - str + 1) {
+      tab = (const char *)memchr(str + start, '\t', end - start);
+      addnstr(str + start, (tab ? (size_t)(tab - str) : end) - start);
+      if (!tab) {
+        break;
       }
-      x = offset + new_x;
-    }
-    else if (new_x - offset > max_width) {
-      move(y, x);
-      clrtoeol();
-      mvprintw(y + 1, offset, "%C", wc);
-      getyx(stdscr, y, x);
+      addch(' ');
     }
-    else {
-      x = new_x;
-    }
-  }
-  if (x > offset || y == top) {
-    return y - top + 1;
   }
-  return y - top;
+  return layout->rows;
 }
 
 void print_message(char *format, ...) {
@@ -102,60 +105,207 @@ void print_message(char *format, ...) {
   attroff(A_REVERSE);
 }
 
-void print_bar(char *status, int rows, int cols, int tasks) {
+void print_bar(STATUS status, int rows, int cols, int done, int tasks, int loading) {
   int i, x;
+  char *counts = NULL;
+  const char *text = NULL;
+  switch (status) {
+    case STATUS_SAVED:
+      text = "Saved";
+      break;
+    case STATUS_UNSAVED:
+      text = "Unsaved";
+      break;
+    case STATUS_SAVING:
+      text = "Saving...";
+      break;
+    case STATUS_UNSAVED_SAVING:
+      text = "Unsaved (saving...)";
+      break;
+  }
   print_commands(main_commands, rows - 1, cols, 1);
   attron(A_REVERSE);
   for (i = 0; i < cols; i++) {
     mvprintw(0, i, " ");
   }
   mvprintw(0, 2, "ctodo %s", CTODO_VERSION);
-  x = cols / 2 - strlen(status) / 2;
-  mvprintw(0, x, "%s", status);
-  mvprintw(0, cols - 18, "%10d %stask%s", 
+  x = cols / 2 - strlen(text) / 2;
+  mvprintw(0, x, "%s", text);
+  counts = string_printf("%d/%d%s %stask%s",
+      done,
       tasks,
+      loading ? "+" : "",
       tasks == 1 ? " " : "",
       tasks == 1 ? "" : "s");
+  if (counts) {
+    mvprintw(0, cols - 2 - strlen(counts), "%s", counts);
+    free(counts);
+  }
   attroff(A_REVERSE);
 }
 
+/* Get the priority of a task inserted next to another one. In the priority
+ * view it is that of the other task, so the new task is shown next to it. */
+int inserted_priority(int order, TASK *task) {
+  return order == ORDER_PRIORITY && task ? task->priority : 0;
+}
+
+/* Move count tasks starting at a position in the list, so that the first of
+ * them ends up at another position. */
+void move_range(TODOLIST *todolist, int from, int count, int to) {
+  move_tasks(todolist, get_task_at(todolist, from),
+      get_task_at(todolist, from + count - 1),
+      get_task_at(todolist, to < from ? to : to + count));
+}
+
+/* Whether a task has subtasks. */
+int has_subtasks(TASK *task) {
+  return task->next && task->next->depth > task->depth;
+}
+
+/* Get the column that a task is indented to in an order. */
+int get_indent(TASK *task, int order, int cols) {
+  int indent = order == ORDER_LIST ? 2 * task->depth : 0;
+  return indent > cols / 2 ? cols / 2 : indent;
+}
+
+/* Get the column of the message of a task, after its checkbox and priority. */
+int get_message_column(TASK *task, int order, int cols) {
+  return get_indent(task, order, cols) + (task->priority ? 10 : 6);
+}
+
+/* Get the text shown for a task, which is its message followed by the number of
+ * done subtasks if it has any and they are counted. Must be freed unless it is
+ * the message. */
+char *get_task_text(TODOLIST *todolist, TASK *task, int counted) {
+  size_t subtasks, done;
+  char *text = NULL;
+  if (!counted || !has_subtasks(task)) {
+    return task->message;
+  }
+  subtasks = count_subtasks(todolist, task, &done);
+  text = string_printf("%s [%lu/%lu]", task->message, (unsigned long)done,
+      (unsigned long)subtasks);
+  return text ? text : task->message;
+}
+
+/* Get the number of rows a task is drawn on, from its cached layout. */
+int get_task_rows(LAYOUTS *layouts, TODOLIST *todolist, TASK *task, int order,
+    int cols, int counted) {
+  char *text = get_task_text(todolist, task, counted);
+  const LAYOUT *layout = get_layout(layouts, task->message, text,
+      cols - 4 - get_message_column(task, order, cols));
+  if (text != task->message) {
+    free(text);
+  }
+  return layout ? layout->rows : 1;
+}
+
+/* Get the position of the last of the shown tasks after (or before if forward
+ * is 0) a position, starting with the task at the position, that fit in a
+ * number of rows. Returns the position if the task doesn't fit by itself. The
+ * tasks aren't drawn. */
+int fit_tasks(LAYOUTS *layouts, TODOLIST *todolist, int order, int position,
+    int rows, int cols, int counted, int forward) {
+  TASK *task = get_shown_task(todolist, order, position);
+  if (task) {
+    rows -= get_task_rows(layouts, todolist, task, order, cols, counted);
+  }
+  while (task && (task = find_shown_task(todolist, order, task, forward))) {
+    rows -= get_task_rows(layouts, todolist, task, order, cols, counted);
+    if (rows < 0) {
+      break;
+    }
+    position += forward ? 1 : -1;
+  }
+  return position;
+}
+
+/* Get the task after the subtasks of the tasks from first to last in the list,
+ * or NULL if they end the list. */
+TASK *get_range_end(TODOLIST *todolist, TASK *first, TASK *last) {
+  TASK *shallow = first;
+  TASK *task = first;
+  /* The subtasks of the other tasks end before those of the last of the
+   * shallowest tasks. */
+  while (task != last) {
+    task = task->next;
+    if (task->depth <= shallow->depth) {
+      shallow = task;
+    }
+  }
+  return get_subtree_end(todolist, shallow);
+}
+
+/* Change the depth of the tasks from first up to end by a number of levels. */
+void indent_tasks(TODOLIST *todolist, TASK *first, TASK *end, int levels) {
+  for (; first != end; first = first->next) {
+    set_task_depth(todolist, first, first->depth + levels);
+  }
+}
+
+/* Start recording changes in the journal if journal mode is enabled for the
+ * list (see journal.h). */
+JOURNAL *start_journal(TODOLIST *todolist, char *filename, int replay) {
+  if (!get_option_bit(todolist, "journal")) {
+    return NULL;
+  }
+  return open_journal(todolist, filename, replay);
+}
+
+/* Queue a save of the full list, or of the changes recorded in the journal. */
+int queue_save(TODOLIST *todolist, JOURNAL *journal, char *filename) {
+  if (journal) {
+    return save_journal(journal, todolist);
+  }
+  return save_todolist_async(todolist, filename);
+}
+
+/* Whether a key only moves the highlight, which doesn't require the whole list
+ * to be loaded. */
+int is_navigation_key(int ch) {
+  switch (ch) {
+    case 'k':
+    case 'K':
+    case KEY_UP:
+    case 'j':
+    case 'J':
+    case KEY_DOWN:
+    case 21: /* ^U */
+    case 339: /* page up */
+    case 4: /* ^D */
+    case 338: /* page down */
+    case 'g':
+    case 262: /* home */
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 void fatal_error() {
   mvprintw(2, 4, "%s", get_last_error());
   refresh();
+  timeout(-1);
   getch();
+  stop_writer();
   endwin();
   exit(1);
 }
 
-int main(int argc, char *argv[]) {
-  char *filename = "todo.txt";
-  char *input_text = NULL;
-  char *origin = NULL;
-  char *status = STATUS_SAVED;
-  int rows, cols, ch, y, highlight = 0, i = 0,
-      orows, ocols, top = 0, bottom = 0, full = 0;
-  TASK *task = NULL;
-  TASK *selected = NULL;
-  TODOLIST *todolist = NULL;
+/* Read the rest of a list being loaded, and prepare it for editing: replay its
+ * journal, set its version, synchronize it if autosync is enabled, and start
+ * recording its history and keeping track of it for searching and filtering.
+ * Returns the list, which is replaced if it was synchronized. */
+TODOLIST *open_list(LOADER *loader, TODOLIST *todolist, char *filename,
+    JOURNAL **journal, HISTORY **history, SEARCH **search, VIEW **view,
+    LAYOUTS **layouts, char **origin) {
   char *file_version = NULL;
-
-  setlocale(LC_ALL, "");
-  initscr();
-  clear();
-  curs_set(0);
-  noecho();
-
-  if (argc > 1) {
-    filename = argv[1];
-  }
-  todolist = load_todolist(filename);
-
-  mvprintw(0, 0, "  ctodo %s", CTODO_VERSION);
-
-  if (!todolist) {
+  if (!finish_load(loader)) {
     error("Could not open %s: %s", filename, get_last_error());
     fatal_error();
   }
+  *journal = start_journal(todolist, filename, 1);
 
   file_version = copy_option(todolist, "version");
   if (file_version) {
@@ -168,71 +318,229 @@ int main(int argc, char *argv[]) {
 
 #ifdef SYNC_ENABLE
   if (get_option_bit(todolist, "autosync")) {
-    origin = copy_option(todolist, "origin");
-    if (origin) {
-      getmaxyx(stdscr, rows, cols);
+    *origin = copy_option(todolist, "origin");
+    if (*origin) {
+      int cols = getmaxx(stdscr);
       mvprintw(2, 5, "Synchronizing tasks...");
       mvprintw(4, 5, "Downloading:");
-      print_multiline(5, 5, origin, cols - 9);
+      print_multiline(*layouts, NULL, 5, 5, *origin, cols - 9);
       refresh();
       /* TODO: merge */
-      TODOLIST *new = pull_todolist(origin);
+      TODOLIST *new = pull_todolist(*origin);
       clear();
       if (new) {
+        if (*journal) {
+          close_journal(*journal, todolist);
+        }
+        close_layouts(*layouts, todolist);
         delete_todolist(todolist);
         todolist = new;
+        *journal = start_journal(todolist, filename, 0);
+        *layouts = open_layouts(todolist);
+        if (!*layouts) {
+          fatal_error();
+        }
       }
       else {
         print_message("Synchronization failed: %s", get_last_error());
       }
     }
   }
+#else
+  (void)layouts;
+  (void)origin;
 #endif
+  *history = open_history(todolist);
+  *search = open_search(todolist);
+  *view = open_view(todolist);
+  return todolist;
+}
+
+int main(int argc, char *argv[]) {
+  char *filename = "todo.txt";
+  char *input_text = NULL;
+  char *origin = NULL;
+  char *query = NULL;
+  char *limit = NULL;
+  STATUS status = STATUS_SAVED;
+  int rows, cols, ch, y, highlight = 0, i = 0, position,
+      orows, ocols, top = 0, bottom = 0, full = 0, order = ORDER_LIST,
+      mark = -1, first, count, hide_done = 0, indent, column, page = 0;
+  char *text = NULL;
+  TASK *task = NULL;
+  TASK *end = NULL;
+  TASK *selected = NULL;
+  TASK *found = NULL;
+  TODOLIST *todolist = NULL;
+  JOURNAL *journal = NULL;
+  HISTORY *history = NULL;
+  SEARCH *search = NULL;
+  VIEW *view = NULL;
+  LAYOUTS *layouts = NULL;
+  LOADER *loader = NULL;
+  size_t changed;
+
+  setlocale(LC_ALL, "");
+  initscr();
+  clear();
+  curs_set(0);
+  noecho();
+
+  if (argc > 1) {
+    filename = argv[1];
+  }
+  todolist = start_load(filename, &loader);
+
+  mvprintw(0, 0, "  ctodo %s", CTODO_VERSION);
+
+  if (!todolist) {
+    error("Could not open %s: %s", filename, get_last_error());
+    fatal_error();
+  }
+  layouts = open_layouts(todolist);
+  if (!layouts) {
+    fatal_error();
+  }
 
   raw();
   keypad(stdscr, 1);
   while (1) {
+    if (loader) {
+      /* The list is read a step at a time between keystrokes, without waiting
+       * for keystrokes until the highlighted task has been read. */
+      do {
+        i = continue_load(loader, LOAD_STEP);
+      } while (i <= highlight && !load_complete(loader));
+      if (load_complete(loader)) {
+        todolist = open_list(loader, todolist, filename, &journal, &history,
+            &search, &view, &layouts, &origin);
+        loader = NULL;
+      }
+    }
     orows = rows;
     ocols = cols;
     getmaxyx(stdscr, rows, cols);
     if (orows != rows || ocols != cols) {
       clear();
+      clear_layouts(layouts);
     }
     y = 2;
-    y += print_multiline(y, 4, todolist->title, cols - 8) + 1;
-    task = todolist->first;
+    y += print_multiline(layouts, todolist->title, y, 4, todolist->title,
+        cols - 8) + 1;
+    /* Number of rows that the tasks are drawn on. */
+    page = rows - 3 - y;
+    /* Only the tasks shown in the view are counted and visited. */
+    i = get_shown_position(todolist, order, NULL);
     if (highlight >= i) highlight = i - 1;
     if (highlight < 0) highlight = 0;
-    if (highlight < top) top = highlight;
-    if (highlight > bottom) top += highlight - bottom;
-    i = 0;
+    if (mark >= i) mark = i - 1;
+    /* The selected range is from the mark to the highlight, or just the
+     * highlight if there is no mark. */
+    first = mark >= 0 && mark < highlight ? mark : highlight;
+    count = (mark >= 0 ? abs(mark - highlight) : 0) + 1;
+    /* The highlighted task is scrolled into view using the number of rows of
+     * each task, which is known from its layout without drawing it. */
+    if (highlight < top) {
+      top = highlight;
+    }
+    else if (highlight > fit_tasks(layouts, todolist, order, top, page, cols,
+          !loader, 1)) {
+      top = fit_tasks(layouts, todolist, order, highlight, page, cols, !loader,
+          0);
+    }
+    bottom = top - 1;
     selected = NULL;
     if (top != 0) {
       mvprintw(y - 1, 2, " * ");
     }
-    while (task) {
-      if (i >= top && y < rows - 3) {
-        if (highlight == i) {
-          attron(A_REVERSE);
-          selected = task;
-        }
-        mvprintw(y, 2, "[%c]", task->done ? 'X' : ' ');
-        y += print_multiline(y, 6, task->message, cols - 10);
-        if (highlight == i) {
-          attroff(A_REVERSE);
-        }
-        bottom = i;
+    /* Only the visible tasks are visited. */
+    task = get_shown_task(todolist, order, top);
+    for (position = top; task && y < rows - 3; position++) {
+      if (highlight == position) {
+        selected = task;
+      }
+      if (position >= first && position < first + count) {
+        attron(A_REVERSE);
+      }
+      if (highlight == position && mark >= 0) {
+        attron(A_BOLD);
+      }
+      /* Subtasks are indented in the list order, and a task with subtasks
+       * is marked with a + if it is collapsed and a - otherwise. */
+      indent = get_indent(task, order, cols);
+      column = get_message_column(task, order, cols);
+      if (has_subtasks(task)) {
+        mvprintw(y, indent, "%c", task->collapsed ? '+' : '-');
+      }
+      mvprintw(y, indent + 2, "[%c]", task->done ? 'X' : ' ');
+      if (task->priority) {
+        mvprintw(y, indent + 6, "(%c)", 'A' + task->priority - PRIORITY_MIN);
       }
-      i++;
-      task = task->next;
+      /* The subtasks are only counted once the list has been read. */
+      text = get_task_text(todolist, task, !loader);
+      y += print_multiline(layouts, task->message, y, column, text,
+          cols - 4 - column);
+      if (text != task->message) {
+        free(text);
+      }
+      attroff(A_REVERSE | A_BOLD);
+      /* The last task is only counted as visible if it isn't cut off. */
+      if (y <= rows - 3) {
+        bottom = position;
+      }
+      task = find_shown_task(todolist, order, task, 1);
     }
     full = y >= rows - 3;
     if (bottom != i - 1) {
       mvprintw(y++, 2, " * ");
     }
-    print_bar(status, rows, cols, i);
+    switch (poll_save()) {
+      case 1:
+        if (status == STATUS_SAVING) {
+          status = STATUS_SAVED;
+        }
+        update_file_info(todolist, filename);
+        print_message("Saved");
+        break;
+      case 0:
+        if (status == STATUS_SAVING) {
+          status = STATUS_UNSAVED;
+        }
+        /* The content of the file is unknown, so the next save replaces it. */
+        todolist->file_size = NO_OFFSET;
+        print_message("Could not save %s: %s", filename, get_last_error());
+        break;
+    }
+    if (save_pending()) {
+      print_bar(status == STATUS_UNSAVED ? STATUS_UNSAVED_SAVING : status,
+          rows, cols, todolist->done_count - todolist->hidden_done_count, i,
+          loader != NULL);
+      timeout(SAVE_POLL_INTERVAL);
+    }
+    else {
+      print_bar(status, rows, cols,
+          todolist->done_count - todolist->hidden_done_count, i,
+          loader != NULL);
+      timeout(loader ? 0 : -1);
+    }
     refresh();
     ch = getch();
+    if (ch == ERR) {
+      continue;
+    }
+    if (loader && !is_navigation_key(ch)) {
+      /* Other commands need the whole list, which is shown before the command
+       * is carried out. */
+      todolist = open_list(loader, todolist, filename, &journal, &history,
+          &search, &view, &layouts, &origin);
+      loader = NULL;
+      ungetch(ch);
+      continue;
+    }
+    /* The changes made by a command are undone together. */
+    if (history) {
+      next_history_step(history);
+    }
 
     switch (ch) {
       case 'k':
@@ -250,17 +558,36 @@ int main(int argc, char *argv[]) {
           clear();
         break;
       case 21: /* ^U */
-      case 339: /* page up */
         highlight -= 5;
         if (highlight < top)
           clear();
         break;
       case 4: /* ^D */
-      case 338: /* page down */
         highlight += 5;
         if (highlight > bottom)
           clear();
         break;
+      case 339: /* page up */
+        /* The tasks that fit on the screen before the top one are shown. */
+        if (top > 0) {
+          top = fit_tasks(layouts, todolist, order, top - 1, page, cols,
+              !loader, 0);
+        }
+        highlight = top;
+        clear();
+        break;
+      case 338: /* page down */
+        position = fit_tasks(layouts, todolist, order, top, page, cols,
+            !loader, 1) + 1;
+        if (position < i) {
+          top = position;
+          highlight = top;
+        }
+        else {
+          highlight = i - 1;
+        }
+        clear();
+        break;
       case 'g':
       case 262: /* home */
         highlight = 0;
@@ -271,23 +598,362 @@ int main(int argc, char *argv[]) {
         highlight = i - 1;
         clear();
         break;
+      case ':':
+        input_text = get_input("Go to task");
+        if (!input_text)
+          fatal_error();
+        position = atoi(input_text);
+        clear();
+        if (input_text[0] && (position < 1 || position > i)) {
+          print_message("No task %s", input_text);
+        }
+        else if (input_text[0]) {
+          highlight = position - 1;
+          /* The task is shown at the top, unless it is already visible. */
+          if (highlight < top || highlight > bottom) {
+            top = highlight;
+            bottom = highlight;
+          }
+        }
+        free(input_text);
+        break;
+      case '/':
+        input_text = get_input("Search");
+        if (!input_text)
+          fatal_error();
+        clear();
+        if (!input_text[0]) {
+          free(input_text);
+          break;
+        }
+        free(query);
+        query = input_text;
+        /* fall through */
+      case 'f':
+      case 'F':
+        if (!query || !search) {
+          break;
+        }
+        task = find_match(search, todolist, order, query, selected, ch != 'F');
+        /* Hidden matches are skipped until the first one is found again. */
+        for (found = task; task && task->hidden; ) {
+          task = find_match(search, todolist, order, query, task, ch != 'F');
+          if (task == found) {
+            task = NULL;
+          }
+        }
+        if (task) {
+          highlight = get_shown_position(todolist, order, task);
+          if (highlight < top || highlight > bottom) {
+            top = highlight;
+            bottom = highlight;
+            clear();
+          }
+        }
+        else if (text_matches(todolist->title, query)) {
+          print_message("Found in the title");
+        }
+        else {
+          print_message("Not found: %s", query);
+        }
+        break;
+      case 'h':
+      case 'H':
+      case 'l':
+      case 'L':
+        if (!view) {
+          break;
+        }
+        if (ch == 'h' || ch == 'H') {
+          hide_done = !hide_done;
+        }
+        else {
+          input_text = get_input("Show tasks containing");
+          if (!input_text)
+            fatal_error();
+          free(limit);
+          limit = input_text[0] ? input_text : NULL;
+          if (!limit) {
+            free(input_text);
+          }
+        }
+        if (!set_view_filter(view, todolist, hide_done, limit)) {
+          fatal_error();
+        }
+        /* The highlight stays on the selected task, or else moves to the next
+         * shown one. */
+        if (selected) {
+          highlight = get_shown_position(todolist, order, selected);
+        }
+        mark = -1;
+        clear();
+        if (ch == 'h' || ch == 'H') {
+          print_message(hide_done ? "Hiding checked tasks"
+              : "Showing checked tasks");
+        }
+        else if (limit) {
+          print_message("Showing tasks containing: %s", limit);
+        }
+        else {
+          print_message("Showing all tasks");
+        }
+        break;
+      case 'u':
+      case 'U':
+        task = selected;
+        do {
+          task = find_open_task(todolist, order, task, ch == 'u');
+        } while (task && task->hidden);
+        if (task) {
+          highlight = get_shown_position(todolist, order, task);
+          if (highlight < top || highlight > bottom)
+            clear();
+        }
+        else {
+          print_message("No unchecked tasks %s", ch == 'u' ? "below" : "above");
+        }
+        break;
       case 'm':
       case 337: /* S-Up */
-        if (selected) {
-          move_task_up(todolist, selected);
-          highlight--;
-          status = STATUS_UNSAVED;
-          clear();
+        if (selected && order == ORDER_LIST) {
+          /* The task is moved with its subtasks past the previous shown task
+           * with the same parent and its subtasks. */
+          task = selected;
+          do {
+            task = find_shallow_task(todolist, task, selected->depth, 0);
+          } while (task && task->depth == selected->depth && task->hidden);
+          if (task && task->depth == selected->depth) {
+            end = get_subtree_end(todolist, selected);
+            move_tasks(todolist, selected, end ? end->prev : todolist->last,
+                task);
+            highlight = get_shown_position(todolist, order, selected);
+            status = STATUS_UNSAVED;
+            clear();
+          }
+        }
+        else if (selected && highlight > 0) {
+          /* Tasks are moved past the shown tasks, and in the priority view
+           * only past tasks with the same priority. */
+          task = get_shown_task(todolist, order, highlight - 1);
+          if (order == ORDER_LIST || task->priority == selected->priority) {
+            move_task(todolist, selected, task);
+            highlight--;
+            status = STATUS_UNSAVED;
+            clear();
+          }
         }
         break;
       case 'M':
       case 336: /* S-Down */
+        if (selected && order == ORDER_LIST) {
+          end = get_subtree_end(todolist, selected);
+          task = end;
+          while (task && task->depth == selected->depth && task->hidden) {
+            task = get_subtree_end(todolist, task);
+          }
+          if (task && task->depth == selected->depth) {
+            move_tasks(todolist, selected, end ? end->prev : todolist->last,
+                get_subtree_end(todolist, task));
+            highlight = get_shown_position(todolist, order, selected);
+            status = STATUS_UNSAVED;
+            clear();
+          }
+        }
+        else if (selected) {
+          task = find_shown_task(todolist, order, selected, 1);
+          if (task && (order == ORDER_LIST
+                || task->priority == selected->priority)) {
+            move_task(todolist, selected, task->next);
+            highlight++;
+            status = STATUS_UNSAVED;
+            clear();
+          }
+        }
+        break;
+      case 9: /* tab */
+      case 353: /* S-Tab */
+        if (!selected) {
+          break;
+        }
+        if (order != ORDER_LIST) {
+          print_message("Tasks can only be indented in list order");
+          break;
+        }
+        /* The selected tasks are indented with their subtasks, at most one
+         * level deeper than the task before them. */
+        task = get_shown_task(todolist, order, first);
+        end = get_range_end(todolist, task,
+            get_shown_task(todolist, order, first + count - 1));
+        if (ch == 9 && task->prev && task->depth <= task->prev->depth) {
+          indent_tasks(todolist, task, end, 1);
+          status = STATUS_UNSAVED;
+        }
+        else if (ch == 353) {
+          for (found = task; found != end && found->depth;
+              found = found->next) {
+          }
+          if (found == end) {
+            indent_tasks(todolist, task, end, -1);
+            status = STATUS_UNSAVED;
+          }
+        }
+        clear();
+        break;
+      case 260: /* left */
+        if (!selected || !view) {
+          break;
+        }
+        /* A task is collapsed if it has subtasks, and otherwise the
+         * highlight moves to its parent. */
+        if (!selected->collapsed && has_subtasks(selected)) {
+          set_task_collapsed(view, todolist, selected, 1);
+        }
+        else if ((task = get_parent_task(todolist, selected)) && !task->hidden) {
+          highlight = get_shown_position(todolist, order, task);
+        }
+        mark = -1;
+        clear();
+        break;
+      case 261: /* right */
+        if (!selected || !view) {
+          break;
+        }
+        set_task_collapsed(view, todolist, selected, 0);
+        mark = -1;
+        clear();
+        break;
+      case 'v':
+      case 'V':
+        if (mark < 0 && selected) {
+          mark = highlight;
+          print_message("Selecting tasks, press v to cancel");
+        }
+        else {
+          mark = -1;
+          clear();
+        }
+        break;
+      case '<':
+      case '>':
+      case 'o':
+        if (!selected) {
+          break;
+        }
+        if (order != ORDER_LIST || todolist->hidden_count) {
+          print_message("Tasks can only be moved in list order without a"
+              " filter");
+          break;
+        }
+        /* The subtasks of the selected tasks are moved with them. */
+        end = get_range_end(todolist, get_task_at(todolist, first),
+            get_task_at(todolist, first + count - 1));
+        count = get_task_position(todolist, end) - first;
+        if (ch == 'o') {
+          input_text = get_input("Move to position");
+          if (!input_text)
+            fatal_error();
+          position = atoi(input_text);
+          clear();
+          if (input_text[0] && (position < 1 || position > i)) {
+            print_message("No task %s", input_text);
+            position = 0;
+          }
+          free(input_text);
+          if (!position) {
+            break;
+          }
+          position--;
+          if (position > i - count) {
+            position = i - count;
+          }
+        }
+        else {
+          position = ch == '<' ? 0 : i - count;
+        }
+        move_range(todolist, first, count, position);
+        /* The moved tasks stay selected. */
+        highlight += position - first;
+        if (mark >= 0) {
+          mark += position - first;
+        }
+        if (highlight < top || highlight > bottom) {
+          top = highlight;
+          bottom = highlight;
+        }
+        status = STATUS_UNSAVED;
+        clear();
+        break;
+      case 'X':
+        /* The highlight stays on the selected task, or else moves to the next
+         * task that isn't deleted, counting only the shown tasks. */
+        task = selected && selected->done
+          ? find_open_task(todolist, order, selected, 1) : selected;
+        position = delete_done_tasks(todolist);
+        i = get_shown_position(todolist, order, NULL);
         if (selected) {
-          move_task_down(todolist, selected);
-          highlight++;
+          highlight = get_shown_position(todolist, order, task);
+        }
+        mark = -1;
+        clear();
+        if (position) {
+          status = STATUS_UNSAVED;
+        }
+        print_message("Deleted %d done task%s", position,
+            position == 1 ? "" : "s");
+        break;
+      case 26: /* ^Z */
+      case 25: /* ^Y */
+        if (!history) {
+          break;
+        }
+        changed = selected ? get_task_position(todolist, selected) : 0;
+        if (ch == 26 ? undo_history(history, todolist, &changed)
+            : redo_history(history, todolist, &changed)) {
+          task = get_task_at(todolist, changed);
+          highlight = task ? (int)get_shown_position(todolist, order, task)
+            : (int)changed;
+          if (highlight < top || highlight > bottom) {
+            top = highlight;
+            bottom = highlight;
+          }
+          mark = -1;
           status = STATUS_UNSAVED;
           clear();
+          print_message(ch == 26 ? "Undone" : "Redone");
+        }
+        else {
+          print_message(ch == 26 ? "Nothing to undo" : "Nothing to redo");
+        }
+        break;
+      case 'p':
+        mark = -1;
+        order = order == ORDER_LIST ? ORDER_PRIORITY : ORDER_LIST;
+        if (selected) {
+          highlight = get_shown_position(todolist, order, selected);
+        }
+        clear();
+        print_message(order == ORDER_LIST ? "List order" : "Priority order");
+        break;
+      case 'P':
+        if (!selected) {
+          break;
+        }
+        input_text = get_input("Priority (A-Z or - for none)");
+        if (!input_text)
+          fatal_error();
+        position = toupper((unsigned char)input_text[0]);
+        clear();
+        if (position == '-'
+            || (position >= 'A' && position < 'A' + PRIORITY_MAX)) {
+          set_task_priority(todolist, selected,
+              position == '-' ? 0 : position - 'A' + PRIORITY_MIN);
+          highlight = get_shown_position(todolist, order, selected);
+          status = STATUS_UNSAVED;
         }
+        else if (position) {
+          print_message("Invalid priority: %s", input_text);
+        }
+        free(input_text);
         break;
 #ifdef SYNC_ENABLE
       case 'z': /* TODO */
@@ -303,24 +969,52 @@ int main(int argc, char *argv[]) {
 #endif
       case 'R':
       case 'r':
+        if (wait_for_save() == 0) {
+          print_message("Could not save %s: %s", filename, get_last_error());
+          break;
+        }
         i = 0;
         TODOLIST *new = load_todolist(filename);
         if (!new) {
           print_message("Could not load %s: %s", filename, get_last_error());
         }
         else {
+          if (journal) {
+            close_journal(journal, todolist);
+          }
+          if (history) {
+            close_history(history, todolist);
+          }
+          if (search) {
+            close_search(search, todolist);
+          }
+          if (view) {
+            close_view(view, todolist);
+          }
+          close_layouts(layouts, todolist);
           delete_todolist(todolist);
           todolist = new;
+          journal = start_journal(todolist, filename, 1);
+          history = open_history(todolist);
+          search = open_search(todolist);
+          view = open_view(todolist);
+          if (view) {
+            set_view_filter(view, todolist, hide_done, limit);
+          }
+          layouts = open_layouts(todolist);
+          if (!layouts) {
+            fatal_error();
+          }
           status = STATUS_SAVED;
+          mark = -1;
           clear();
           print_message("Reloaded");
         }
         break;
       case 'S':
       case 's':
-        if (save_todolist(todolist, filename)) {
-          print_message("Saved");
-          status = STATUS_SAVED;
+        if (queue_save(todolist, journal, filename)) {
+          status = STATUS_SAVING;
         }
         else {
           print_message("Could not save %s: %s", filename, get_last_error());
@@ -331,10 +1025,51 @@ int main(int argc, char *argv[]) {
       case 'd':
       case '-':
       case 330: /* del */
-        i--;
-        if (selected) {
+        if (!selected) {
+          break;
+        }
+        if (mark < 0 && (order != ORDER_LIST || !has_subtasks(selected))) {
           delete_task(selected, todolist);
         }
+        else if (mark < 0) {
+          /* The subtasks are deleted with the task. */
+          end = get_subtree_end(todolist, selected);
+          delete_tasks(todolist, selected, end ? end->prev : todolist->last);
+        }
+        else if (order == ORDER_LIST && !todolist->hidden_count) {
+          end = get_range_end(todolist, get_task_at(todolist, first),
+              get_task_at(todolist, first + count - 1));
+          delete_tasks(todolist, get_task_at(todolist, first),
+              end ? end->prev : todolist->last);
+        }
+        else {
+          /* The selected tasks are deleted in runs of tasks that are next to
+           * each other in the list, each with a single splice. In the list
+           * order each task is deleted with its subtasks, hidden or not, and
+           * the shown subtasks count as selected. */
+          task = get_shown_task(todolist, order, first);
+          for (position = 0; task && position < count; ) {
+            found = task;
+            do {
+              end = found;
+              if (order == ORDER_LIST) {
+                found = get_subtree_end(todolist, end);
+                position += (int)(get_shown_position(todolist, order, found)
+                    - get_shown_position(todolist, order, end));
+                end = found ? found->prev : todolist->last;
+              }
+              else {
+                position++;
+              }
+              found = find_shown_task(todolist, order, end, 1);
+            } while (position < count && found && found == end->next);
+            delete_tasks(todolist, task, end);
+            task = found;
+          }
+        }
+        i = get_shown_position(todolist, order, NULL);
+        highlight = first;
+        mark = -1;
         status = STATUS_UNSAVED;
         clear();
         break;
@@ -344,10 +1079,11 @@ int main(int argc, char *argv[]) {
           fatal_error();
         if (input_text[0]) {
           if (selected) {
-            insert_task(todolist, selected, input_text, 0, 0);
+            insert_task(todolist, selected, input_text, 0,
+                inserted_priority(order, selected), selected->depth);
           }
           else {
-            add_task(todolist, input_text, 0, 0);
+            add_task(todolist, input_text, 0, 0, 0);
           }
           status = STATUS_UNSAVED;
           i++;
@@ -362,11 +1098,13 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          if (todolist->first) {
-            insert_task(todolist, todolist->first, input_text, 0, 0);
+          task = get_shown_task(todolist, order, 0);
+          if (task) {
+            insert_task(todolist, task, input_text, 0,
+                inserted_priority(order, task), task->depth);
           }
           else {
-            add_task(todolist, input_text, 0, 0);
+            add_task(todolist, input_text, 0, 0, 0);
           }
           status = STATUS_UNSAVED;
           highlight = 0;
@@ -382,11 +1120,23 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          if (selected && selected->next) {
-            insert_task(todolist, selected->next, input_text, 0, 0);
+          /* The task is inserted after the subtasks of a collapsed task, and
+           * as the first subtask of an expanded one. */
+          task = selected ? selected->next : NULL;
+          position = selected ? selected->depth : 0;
+          if (selected && selected->collapsed) {
+            task = get_subtree_end(todolist, selected);
+          }
+          else if (task && task->depth > position) {
+            position = task->depth;
+          }
+          if (task) {
+            insert_task(todolist, task, input_text, 0,
+                inserted_priority(order, selected), position);
           }
           else {
-            add_task(todolist, input_text, 0, 0);
+            add_task(todolist, input_text, 0,
+                inserted_priority(order, selected), position);
           }
           status = STATUS_UNSAVED;
           if (full && bottom == highlight && bottom < i) {
@@ -410,7 +1160,7 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          add_task(todolist, input_text, 0, 0);
+          add_task(todolist, input_text, 0, 0, 0);
           status = STATUS_UNSAVED;
           if (full && bottom < i) {
             top++;
@@ -433,8 +1183,7 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          free(selected->message);
-          selected->message = input_text;
+          set_task_message(todolist, selected, input_text);
           status = STATUS_UNSAVED;
         }
         else {
@@ -450,8 +1199,7 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          free(selected->message);
-          selected->message = input_text;
+          set_task_message(todolist, selected, input_text);
           status = STATUS_UNSAVED;
         }
         else {
@@ -464,8 +1212,7 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          free(todolist->title);
-          todolist->title = input_text;
+          set_title(todolist, input_text);
           status = STATUS_UNSAVED;
         }
         else {
@@ -478,8 +1225,7 @@ int main(int argc, char *argv[]) {
         if (!input_text)
           fatal_error();
         if (input_text[0]) {
-          free(todolist->title);
-          todolist->title = input_text;
+          set_title(todolist, input_text);
           status = STATUS_UNSAVED;
         }
         else {
@@ -492,7 +1238,26 @@ int main(int argc, char *argv[]) {
         if (!selected) {
           break;
         }
-        selected->done ^= 1;
+        if (mark < 0) {
+          set_task_done(todolist, selected, !selected->done);
+        }
+        else {
+          /* The selected tasks are all checked, unless they already are. */
+          position = 0;
+          task = get_shown_task(todolist, order, first);
+          for (y = 0; y < count; y++) {
+            position |= !task->done;
+            task = find_shown_task(todolist, order, task, 1);
+          }
+          task = get_shown_task(todolist, order, first);
+          for (y = 0; y < count; y++) {
+            /* The next task is found first, since the task may be hidden
+             * when it is checked. */
+            selected = find_shown_task(todolist, order, task, 1);
+            set_task_done(todolist, task, position);
+            task = selected;
+          }
+        }
         status = STATUS_UNSAVED;
         break;
       default:
@@ -506,14 +1271,47 @@ int main(int argc, char *argv[]) {
     }
 
     if (ch == 'q' || ch == 'Q') {
-      if (save_todolist(todolist, filename) || ch == 'Q') {
-        break;
+      if (queue_save(todolist, journal, filename)) {
+        status = STATUS_SAVING;
+        print_bar(status, rows, cols,
+            todolist->done_count - todolist->hidden_done_count, i,
+            loader != NULL);
+        refresh();
+        /* Nothing is written if the journal has no changes since the last
+         * save, in which case no save finishes (-1). */
+        if (wait_for_save() != 0) {
+          /* In journal mode the file doesn't contain the latest changes, so
+           * the snapshot is only updated when it is loaded. */
+          if (!journal) {
+            update_file_info(todolist, filename);
+            update_snapshot(todolist, filename);
+          }
+          break;
+        }
       }
-      else {
-        print_message("Could not save %s: %s", filename, get_last_error());
+      if (ch == 'Q') {
+        break;
       }
+      status = STATUS_UNSAVED;
+      print_message("Could not save %s: %s", filename, get_last_error());
     }
   }
+  stop_writer();
+  if (journal) {
+    close_journal(journal, todolist);
+  }
+  if (history) {
+    close_history(history, todolist);
+  }
+  if (search) {
+    close_search(search, todolist);
+  }
+  if (view) {
+    close_view(view, todolist);
+  }
+  close_layouts(layouts, todolist);
+  free(query);
+  free(limit);
   delete_todolist(todolist);
   endwin();
   return 0;
@@ -6,170 +6,499 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
+#include "config.h"
 #include "file.h"
 #include "stream.h"
+#include "scan.h"
+#include "snapshot.h"
 #include "error.h"
 
-void skip_whitespace(STREAM *file) {
-  int c;
-  while ((c = stream_getc(file)) != EOF && isspace(c)) {
+/* Minimum number of bytes read by each thread when a list is read in
+ * parallel. Smaller lists are read on a single thread. */
+#define PARALLEL_CHUNK_SIZE (4 * 1024 * 1024)
+
+#ifdef HAVE_WRITEV
+#include <sys/uio.h>
+
+/* Maximum number of buffers passed to a single writev() call. */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define IOV_BATCH IOV_MAX
+#else
+#define IOV_BATCH 1024
+#endif
+#endif
+
+/* Priorities as written in front of messages, by priority. */
+static const char *const priority_tags[PRIORITY_MAX + 1] = {
+  "", "(A) ", "(B) ", "(C) ", "(D) ", "(E) ", "(F) ", "(G) ", "(H) ", "(I) ",
+  "(J) ", "(K) ", "(L) ", "(M) ", "(N) ", "(O) ", "(P) ", "(Q) ", "(R) ",
+  "(S) ", "(T) ", "(U) ", "(V) ", "(W) ", "(X) ", "(Y) ", "(Z) "
+};
+
+/* Whether c is a whitespace character other than newline. */
+static int is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Skip whitespace, but not past the end of the line. */
+static const char *skip_blank(const char *pos, const char *end) {
+  while (pos < end && is_blank(*pos)) {
+    pos++;
   }
-  stream_ungetc(c, file);
+  return pos;
+}
+
+/* Whether a string of the given length starts with a priority tag, e.g.
+ * "(A) ". */
+static int is_priority_tag(const char *text, size_t length) {
+  return length >= 4 && text[0] == '(' && text[1] >= 'A'
+    && text[1] < 'A' + PRIORITY_MAX && text[2] == ')' && text[3] == ' ';
 }
 
-void skip_horizontal_whitespace(STREAM *file) {
-  int c;
-  while ((c = stream_getc(file)) != EOF && isspace(c) && c != '\n') {
+/* Whether a message would be read with a different priority if it were
+ * written without a tag, i.e. it starts with a priority tag, possibly after
+ * backslashes and whitespace (which is skipped when a line is read). A
+ * backslash is written in front of such a message, which is removed when it
+ * is read. */
+static int needs_escape(const char *text, size_t length) {
+  while (length > 0 && (*text == '\\' || is_blank(*text))) {
+    text++;
+    length--;
   }
-  stream_ungetc(c, file);
+  return is_priority_tag(text, length);
 }
 
-void skip_line(STREAM *file) {
-  int c;
-  while ((c = stream_getc(file)) != EOF && c != '\n') {
+/* Get the text written between the checkbox and the message of a task. */
+static const char *get_prefix(TASK *task) {
+  if (task->priority) {
+    return priority_tags[task->priority];
   }
-  stream_ungetc(c, file);
+  return needs_escape(task->message, strlen(task->message)) ? "\\" : "";
 }
 
-/* Read until the end of the line or EOF. */
-char *read_string(STREAM *file) {
-  int buffersize = 10;
-  int c, i = 0;
-  char *newbuffer = NULL;
-  char *buffer = (char *)malloc(buffersize);
-  while ((c = stream_getc(file)) != EOF && c != '\n') {
-    buffer[i++] = c;
-    if (i >= buffersize) {
-      newbuffer = resize_buffer(buffer, buffersize, buffersize + buffersize);
-      if (!newbuffer) {
-        free(buffer);
-        return NULL;
-      }
-      buffer = newbuffer;
-      buffersize += buffersize;
-    }
+/* Copy part of a line into a new string. */
+static char *copy_span(const char *start, size_t length) {
+  char *str = (char *)malloc(length + 1);
+  if (!str) {
+    return NULL;
   }
-  buffer[i] = 0;
-  return buffer;
+  memcpy(str, start, length);
+  str[length] = '\0';
+  return str;
 }
 
-/* Read until the next space, '=', EOL, or EOF. Escape using backslash. */
-char *read_option_string(STREAM *file) {
-  int buffersize = 10;
-  int c, i = 0;
-  char *newbuffer = NULL;
-  char *buffer = (char *)malloc(buffersize);
-  while ((c = stream_getc(file)) != EOF && c != '\n' && c != '=' && c > ' ') {
-    if (c == '\\') {
-      c = stream_getc(file);
-      if (c == EOF) {
-        break;
-      }
+/* Read until the next space, '=', or end of line. Escape using backslash. An
+ * escaped newline continues the string on the next line of the input, in which
+ * case pos and end are moved to that line. */
+static char *read_option_string(STREAM *input, const char **pos, const char **end) {
+  STREAM *buffer = stream_new_buffer(16);
+  const char *p = *pos;
+  const char *start = p;
+  size_t length;
+  if (!buffer) {
+    return NULL;
+  }
+  while (p < *end && *p != '=' && (unsigned char)*p > ' ') {
+    if (*p != '\\') {
+      p++;
+      continue;
     }
-    buffer[i++] = c;
-    if (i >= buffersize) {
-      newbuffer = resize_buffer(buffer, buffersize, buffersize + buffersize);
-      if (!newbuffer) {
-        free(buffer);
-        return NULL;
-      }
-      buffer = newbuffer;
-      buffersize += buffersize;
+    stream_write(start, 1, p - start, buffer);
+    p++;
+    if (p < *end) {
+      start = p++;
+      continue;
+    }
+    start = stream_line(input, &length);
+    if (!start) {
+      start = p;
+      break;
     }
+    stream_putc('\n', buffer);
+    p = start;
+    *end = start + length;
   }
-  stream_ungetc(c, file);
-  buffer[i] = 0;
-  return buffer;
+  stream_write(start, 1, p - start, buffer);
+  *pos = p;
+  return stream_close_buffer(buffer, NULL);
 }
 
-void read_next_option(STREAM *file, TODOLIST *list) {
-  char c;
+/* Read the options on a line starting with '#'. */
+static void read_options(STREAM *input, const char *pos, const char *end, TODOLIST *list) {
   char *key = NULL;
   char *value = NULL;
   while (1) {
-    skip_horizontal_whitespace(file);
-    key = read_option_string(file);
+    pos = skip_blank(pos, end);
+    key = read_option_string(input, &pos, &end);
+    if (!key) {
+      return;
+    }
     if (key[0] == '\0') {
       free(key);
-      skip_line(file);
       return;
     }
-    skip_horizontal_whitespace(file);
-    c = stream_getc(file);
-    if (c != '=') {
-      stream_ungetc(c, file);
+    pos = skip_blank(pos, end);
+    if (pos >= end || *pos != '=') {
       set_option_bit(list, key, 1);
+      free(key);
       continue;
     }
-    skip_horizontal_whitespace(file);
-    value = read_option_string(file);
-    set_option(list, key, value);
+    pos = skip_blank(pos + 1, end);
+    value = read_option_string(input, &pos, &end);
+    if (value) {
+      set_option(list, key, value);
+      free(value);
+    }
     free(key);
-    free(value);
   }
 }
 
-void read_next_task(STREAM *file, TODOLIST *list) {
-  char c;
+/* Read a task or options from a line. Other lines are ignored. Returns the
+ * task if the line contained one. If the list has an image of the file, the
+ * message is terminated in place instead of being copied. */
+static TASK *read_line(STREAM *input, LINE *line, TODOLIST *list) {
   char *message = NULL;
-  int done = 0;
+  const char *text = line->text;
+  size_t length = line->text_length;
   int priority = 0;
-  skip_whitespace(file);
-  c = stream_getc(file);
-  if (c != '[') {
-    if (c == '#') {
-      read_next_option(file, list);
-      skip_line(file);
-      return;
+  if (line->type == LINE_OPTIONS) {
+    read_options(input, line->text, line->start + line->length, list);
+    return NULL;
+  }
+  if (line->type != LINE_TASK) {
+    return NULL;
+  }
+  /* A priority is written as e.g. "(A) " in front of the message. A message
+   * without a priority that looks like it has one is escaped with a
+   * backslash. */
+  if (is_priority_tag(text, length)) {
+    priority = text[1] - 'A' + PRIORITY_MIN;
+    text += 4;
+    length -= 4;
+  }
+  else if (length > 0 && text[0] == '\\' && needs_escape(text + 1, length - 1)) {
+    text++;
+    length--;
+  }
+  if (list->image) {
+    message = (char *)text;
+    message[length] = '\0';
+  }
+  else {
+    message = arena_copy(&list->arena, text, length);
+  }
+  if (!message) {
+    return NULL;
+  }
+  add_task(list, message, line->done, priority, line->depth);
+  return list->last && list->last->message == message ? list->last : NULL;
+}
+
+/* State of a list being read. */
+struct LOADER {
+  STREAM *input; /* Stream the list is read from, or NULL if the list was
+                    loaded from a snapshot. */
+  TODOLIST *list; /* List being read. */
+  const char *content; /* Content of input if it is in memory, otherwise NULL. */
+  const char *end; /* End of content. */
+  int canonical; /* Whether the lines read so far are written exactly as they
+                    would be saved, in which case task offsets are recorded. */
+  size_t tasks; /* Number of tasks read. */
+  char *filename; /* File the list is loaded from, or NULL. */
+  int snapshot; /* Whether a snapshot is written once the list is loaded. */
+  SNAPSHOT_KEY key; /* Key of the file if snapshot is set. */
+};
+
+/* Read up to max lines of a stream into a list. Returns the number of lines
+ * read. */
+static size_t read_lines(LOADER *loader, size_t max) {
+  LINE line;
+  const char *start = NULL;
+  const char *end = NULL;
+  size_t length = 0;
+  size_t read = 0;
+  TASK *task = NULL;
+  /* The stream is at the end of the line while it is read, since options can
+   * continue on the following lines. */
+  while (read < max && (start = stream_span(loader->input, &length))) {
+    end = (const char *)memchr(start, '\n', length);
+    if (end) {
+      length = end - start;
+      stream_advance(loader->input, length + 1);
+    }
+    else {
+      /* The line continues past the current block or is not terminated. */
+      start = stream_line(loader->input, &length);
+    }
+    classify_line(&line, start, length);
+    task = read_line(loader->input, &line, loader->list);
+    read++;
+    if (task) {
+      loader->tasks++;
+    }
+    /* A task on the last line is only canonical if the line is terminated. */
+    if (loader->canonical && task && line.canonical
+        && start + length < loader->end) {
+      task->offset = start - loader->content;
+      loader->list->clean_end = task->offset + length + 1;
+    }
+    else {
+      loader->canonical = 0;
     }
-    stream_ungetc(c, file);
-    skip_line(file);
-    return;
   }
-  c = stream_getc(file);
-  switch (c) {
-    case 'X':
-    case 'x':
-      done = 1;
-      break;
-    case ' ':
-      done = 0;
-      break;
-    default:
-      stream_ungetc(c, file);
-      skip_line(file);
-      return;
+  return read;
+}
+
+/* Part of the input read by a worker thread. */
+typedef struct CHUNK {
+  pthread_t thread; /* Worker thread. */
+  int started; /* Whether the worker thread was started. */
+  const char *start; /* Start of chunk. */
+  size_t length; /* Length of chunk. */
+  char *image; /* Image of the file, if the input is one. */
+  size_t image_size; /* Size of image. */
+  LOADER loader; /* State of the chunk. */
+} CHUNK;
+
+static void *read_chunk(void *arg) {
+  CHUNK *chunk = (CHUNK *)arg;
+  chunk->loader.input = stream_buffer((char *)chunk->start, chunk->length);
+  chunk->loader.list = chunk->loader.input ? new_todolist(NULL) : NULL;
+  if (chunk->loader.list) {
+    /* The messages point into the image, so the list doesn't own them. */
+    chunk->loader.list->image = chunk->image;
+    chunk->loader.list->image_size = chunk->image_size;
+    read_lines(&chunk->loader, (size_t)-1);
   }
-  c = stream_getc(file);
-  if (c != ']') {
-    stream_ungetc(c, file);
-    skip_line(file);
-    return;
+  if (chunk->loader.input) {
+    stream_close(chunk->loader.input);
   }
-  skip_whitespace(file);
-  message = read_string(file);
-  add_task(list, message, done, priority);
+  return NULL;
 }
 
-TODOLIST *read_todolist(STREAM *input) {
-  TODOLIST *list = (TODOLIST *)malloc(sizeof(TODOLIST));
-  if (!list) {
+/* Find the first line after pos that doesn't continue the line before it, i.e.
+ * an option escaping the newline with a backslash. */
+static const char *find_chunk_start(const char *pos, const char *end) {
+  while ((pos = memchr(pos, '\n', end - pos))) {
+    pos++;
+    if (pos[-2] != '\\') {
+      return pos;
+    }
+  }
+  return end;
+}
+
+/* Append the tasks and options read from a chunk to a list. Returns 0 if there
+ * isn't enough memory, in which case the tasks are left in the chunk. */
+static int append_chunk(TODOLIST *list, TODOLIST *part) {
+  OPTION *opt = NULL;
+  int order;
+  /* The options are copied, since the arena of the chunk is merged into that
+   * of the list below. */
+  for (opt = part->first_option; opt; opt = opt->next) {
+    set_option(list, opt->key, opt->value);
+    if (!arena_contains(&part->arena, opt->value)) {
+      free(opt->value);
+    }
+  }
+  part->first_option = NULL;
+  part->last_option = NULL;
+  /* The tasks were allocated from the arena of the chunk. */
+  if (!arena_merge(&list->arena, &part->arena)) {
+    return 0;
+  }
+  if (part->first) {
+    if (list->last) {
+      list->last->next = part->first;
+      part->first->prev = list->last;
+    }
+    else {
+      list->first = part->first;
+    }
+    list->last = part->last;
+  }
+  part->first = NULL;
+  part->last = NULL;
+  list->task_count += part->task_count;
+  list->done_count += part->done_count;
+  part->task_count = 0;
+  part->done_count = 0;
+  /* The indexes are rebuilt when they are next needed. */
+  for (order = 0; order < ORDER_COUNT; order++) {
+    list->indexed[order] = 0;
+  }
+  list->owned_messages += part->owned_messages;
+  part->owned_messages = 0;
+  part->free_tasks = NULL;
+  part->slab_next = NULL;
+  part->slab_end = NULL;
+  return 1;
+}
+
+/* Read the rest of a stream, whose whole content is in memory, into a list
+ * using a thread for each chunk. The chunks are split at newlines and appended
+ * to the list in order, so the result is the same as that of read_lines().
+ * Returns 0 on error. */
+static int read_chunks(LOADER *loader, size_t count) {
+  CHUNK *chunks = NULL;
+  TASK *task = NULL;
+  TODOLIST *part = NULL;
+  const char *start = NULL;
+  const char *next = NULL;
+  size_t length, i;
+  int status = 1;
+  start = stream_span(loader->input, &length);
+  if (!start) {
+    return 1;
+  }
+  chunks = (CHUNK *)malloc(count * sizeof(CHUNK));
+  if (!chunks) {
+    error("Could not allocate memory");
+    return 0;
+  }
+  /* All chunks are found before any thread starts, since reading a chunk
+   * replaces its newlines with NUL bytes. */
+  for (i = 0; i < count; i++) {
+    chunks[i].start = i > 0 ? chunks[i - 1].start + chunks[i - 1].length : start;
+    next = loader->end;
+    if (i + 1 < count) {
+      next = start + (i + 1) * (length / count);
+      next = find_chunk_start(next > chunks[i].start ? next : chunks[i].start,
+          loader->end);
+    }
+    chunks[i].length = next - chunks[i].start;
+  }
+  for (i = 0; i < count; i++) {
+    chunks[i].image = loader->list->image;
+    chunks[i].image_size = loader->list->image_size;
+    chunks[i].loader.list = NULL;
+    chunks[i].loader.content = loader->content;
+    chunks[i].loader.end = loader->end;
+    chunks[i].loader.canonical = 1;
+    chunks[i].loader.tasks = 0;
+    chunks[i].loader.filename = NULL;
+    chunks[i].started = i > 0 && pthread_create(&chunks[i].thread, NULL,
+        read_chunk, &chunks[i]) == 0;
+  }
+  /* The first chunk, and any chunk for which a thread could not be started, is
+   * read on this thread. */
+  for (i = 0; i < count; i++) {
+    if (chunks[i].started) {
+      pthread_join(chunks[i].thread, NULL);
+    }
+    else {
+      read_chunk(&chunks[i]);
+    }
+  }
+  for (i = 0; i < count; i++) {
+    part = chunks[i].loader.list;
+    if (!part) {
+      status = 0;
+      continue;
+    }
+    /* Offsets are only valid if everything before the chunk is canonical. */
+    if (!loader->canonical) {
+      for (task = part->first; task; task = task->next) {
+        task->offset = NO_OFFSET;
+      }
+    }
+    else if (part->clean_end) {
+      loader->list->clean_end = part->clean_end;
+    }
+    loader->canonical = loader->canonical && chunks[i].loader.canonical;
+    loader->tasks += chunks[i].loader.tasks;
+    if (!append_chunk(loader->list, part)) {
+      status = 0;
+    }
+    part->image = NULL;
+    delete_todolist(part);
+  }
+  free(chunks);
+  stream_advance(loader->input, length);
+  if (!status) {
+    error("Could not allocate memory");
+  }
+  return status;
+}
+
+/* Start reading a list by creating it and reading the title. If image is set,
+ * it is the content of input followed by room for a NUL byte, and it is owned
+ * by the list. Returns 0 on error. */
+static int init_loader(LOADER *loader, STREAM *input, char *image) {
+  const char *line = NULL;
+  size_t length = 0;
+  loader->input = input;
+  loader->content = stream_get_content(input);
+  loader->end = loader->content + stream_get_size(input);
+  loader->canonical = 0;
+  loader->tasks = 0;
+  loader->filename = NULL;
+  loader->snapshot = 0;
+  line = stream_line(input, &length);
+  loader->list = new_todolist(copy_span(line ? line : "", line ? length : 0));
+  if (!loader->list) {
+    free(image);
     error("Could not allocate memory");
+    return 0;
+  }
+  if (image) {
+    loader->list->image = image;
+    loader->list->image_size = stream_get_size(input) + 1;
+  }
+  /* The offsets of tasks are recorded as long as the file is written exactly as
+   * it would be saved, which requires the content of the stream. */
+  if (loader->content && line && line + length < loader->end) {
+    loader->list->clean_end = length + 1;
+    loader->canonical = 1;
+  }
+  return 1;
+}
+
+/* Read the rest of a list, using a thread for each of the given number of
+ * chunks of the remaining input. If chunks is 0, a chunk is used for each
+ * PARALLEL_CHUNK_SIZE bytes, up to the number of processors. Returns 0 on
+ * error. */
+static int read_rest(LOADER *loader, size_t chunks) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t length = 0;
+  stream_span(loader->input, &length);
+  if (!chunks) {
+    chunks = length / PARALLEL_CHUNK_SIZE;
+    if (cpus > 0 && chunks > (size_t)cpus) {
+      chunks = cpus;
+    }
+  }
+  if (!loader->content || chunks < 2) {
+    read_lines(loader, (size_t)-1);
+    return 1;
+  }
+  return read_chunks(loader, chunks);
+}
+
+/* Read a list from a stream using the given number of chunks (see
+ * read_rest()). */
+static TODOLIST *read_todolist_chunks(STREAM *input, size_t chunks) {
+  LOADER loader;
+  if (!init_loader(&loader, input, NULL)) {
     return NULL;
   }
-  list->first = NULL;
-  list->last = NULL;
-  list->first_option = NULL;
-  list->last_option = NULL;
-  list->title = read_string(input);
-  while (!stream_eof(input)) {
-    read_next_task(input, list);
+  if (!read_rest(&loader, chunks)) {
+    delete_todolist(loader.list);
+    return NULL;
   }
-  return list;
+  return loader.list;
+}
+
+TODOLIST *read_todolist(STREAM *input) {
+  return read_todolist_chunks(input, 0);
 }
 
 int touch_file(char *filename) {
@@ -181,27 +510,204 @@ int touch_file(char *filename) {
   return 1;
 }
 
-TODOLIST *load_todolist(char *filename) {
-  TODOLIST *list = NULL;
-  STREAM *file = stream_file(filename, "r");
-  if (!file) {
-    if (touch_file(filename)) {
-      return load_todolist(filename);
+/* Read the content of a file into a new buffer, followed by room for a NUL
+ * byte. The status of the file before it was read is stored in st. Sets errno
+ * and returns NULL on failure. */
+static char *read_file(const char *filename, size_t *length, struct stat *st) {
+  size_t capacity = 4096;
+  ssize_t n;
+  int saved_errno;
+  char *buffer = NULL;
+  char *grown = NULL;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  /* Regular files are read with a single allocation, leaving room for the NUL
+   * byte and for detecting the end of the file. */
+  if (fstat(fd, st) != 0) {
+    st->st_mode = 0;
+  }
+  else if (S_ISREG(st->st_mode)) {
+    capacity = st->st_size + 2;
+  }
+  buffer = (char *)malloc(capacity);
+  *length = 0;
+  errno = ENOMEM;
+  while (buffer) {
+    if (*length + 1 == capacity) {
+      grown = (char *)realloc(buffer, capacity * 2);
+      if (!grown) {
+        free(buffer);
+        buffer = NULL;
+        errno = ENOMEM;
+        break;
+      }
+      buffer = grown;
+      capacity *= 2;
+    }
+    n = read(fd, buffer + *length, capacity - *length - 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n < 0) {
+        saved_errno = errno;
+        free(buffer);
+        buffer = NULL;
+        errno = saved_errno;
+      }
+      break;
+    }
+    *length += n;
+  }
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return buffer;
+}
+
+/* Start loading a list from the snapshot of a file. Returns NULL if the
+ * snapshot can't be used. */
+static TODOLIST *start_snapshot_load(char *filename, LOADER **loader) {
+  TODOLIST *list = load_snapshot(filename);
+  if (!list) {
+    return NULL;
+  }
+  *loader = (LOADER *)malloc(sizeof(LOADER));
+  if (!*loader) {
+    delete_todolist(list);
+    return NULL;
+  }
+  (*loader)->input = NULL;
+  (*loader)->list = list;
+  (*loader)->tasks = list->task_count;
+  (*loader)->snapshot = 0;
+  (*loader)->filename = string_printf("%s", filename);
+  return list;
+}
+
+TODOLIST *start_load(char *filename, LOADER **loader) {
+  STREAM *input = NULL;
+  struct stat st;
+  size_t length;
+  char *image = NULL;
+  TODOLIST *list = start_snapshot_load(filename, loader);
+  if (list) {
+    return list;
+  }
+  image = read_file(filename, &length, &st);
+  if (!image) {
+    if (errno == ENOENT && touch_file(filename)) {
+      return start_load(filename, loader);
     }
     else {
       error("%s", strerror(errno));
       return NULL;
     }
   }
-  list = read_todolist(file);
-  stream_close(file);
+  /* Messages point into the image of the file, so each task doesn't need an
+   * allocation of its own. */
+  input = stream_buffer(image, length);
+  *loader = (LOADER *)malloc(sizeof(LOADER));
+  if (!input || !*loader) {
+    if (input) {
+      stream_close(input);
+    }
+    free(*loader);
+    free(image);
+    error("Could not allocate memory");
+    return NULL;
+  }
+  if (!init_loader(*loader, input, image)) {
+    stream_close(input);
+    free(*loader);
+    return NULL;
+  }
+  (*loader)->filename = string_printf("%s", filename);
+  /* The key is computed before the image is modified by parsing it. */
+  if (S_ISREG(st.st_mode) && length >= SNAPSHOT_MIN_SIZE) {
+    get_snapshot_key(&(*loader)->key, &st, image, length);
+    (*loader)->snapshot = 1;
+  }
+  return (*loader)->list;
+}
+
+size_t continue_load(LOADER *loader, size_t lines) {
+  if (loader->input) {
+    read_lines(loader, lines);
+  }
+  return loader->tasks;
+}
+
+int load_complete(LOADER *loader) {
+  return !loader->input || stream_peek(loader->input) == EOF;
+}
+
+int finish_load(LOADER *loader) {
+  return finish_load_chunks(loader, 0);
+}
+
+int finish_load_chunks(LOADER *loader, size_t chunks) {
+  int status = 1;
+  if (loader->input) {
+    status = read_rest(loader, chunks);
+    if (status) {
+      loader->list->file_size = stream_get_size(loader->input);
+    }
+    stream_close(loader->input);
+  }
+  if (status && loader->filename) {
+    update_file_info(loader->list, loader->filename);
+    /* The snapshot is only useful if the file is unchanged. */
+    if (loader->snapshot && loader->list->file_size != NO_OFFSET) {
+      save_snapshot_async(loader->list, loader->filename, &loader->key);
+    }
+  }
+  free(loader->filename);
+  free(loader);
+  return status;
+}
+
+TODOLIST *load_todolist(char *filename) {
+  LOADER *loader = NULL;
+  TODOLIST *list = start_load(filename, &loader);
+  if (!list) {
+    return NULL;
+  }
+  if (!finish_load(loader)) {
+    delete_todolist(list);
+    return NULL;
+  }
   return list;
 }
 
+void update_file_info(TODOLIST *todolist, const char *filename) {
+  struct stat st;
+  if (stat(filename, &st) != 0 || (size_t)st.st_size != todolist->file_size) {
+    todolist->file_size = NO_OFFSET;
+    return;
+  }
+  todolist->file_mtime = (long)st.st_mtime;
+}
+
+int file_unchanged(TODOLIST *todolist, const char *filename) {
+  struct stat st;
+  if (todolist->file_size == NO_OFFSET || stat(filename, &st) != 0) {
+    return 0;
+  }
+  return (size_t)st.st_size == todolist->file_size
+    && (long)st.st_mtime == todolist->file_mtime;
+}
+
 TODOLIST *parse_todolist(char *source, size_t length) {
+  return parse_todolist_chunks(source, length, 0);
+}
+
+TODOLIST *parse_todolist_chunks(char *source, size_t length, size_t chunks) {
   TODOLIST *list = NULL;
   STREAM *input = stream_buffer(source, length);
-  list = read_todolist(input);
+  list = read_todolist_chunks(input, chunks);
   stream_close(input);
   return list;
 }
@@ -219,17 +725,10 @@ size_t escape_string(STREAM *output, const char *str) {
   return l;
 }
 
-void write_todolist(STREAM *output, TODOLIST *todolist) {
+/* Write the option lines of a list. */
+void write_options(STREAM *output, TODOLIST *todolist) {
   OPTION *opt = NULL;
-  TASK *task = NULL;
   int width = 0;
-  stream_printf(output, "%s\n", todolist->title);
-  task = todolist->first;
-  while (task) {
-    stream_printf(output, "[%c] %s\n",
-        task->done ? 'X' : ' ', task->message);
-    task = task->next;
-  }
   opt = todolist->first_option;
   if (opt) {
     width += stream_printf(output, "#");
@@ -249,18 +748,206 @@ void write_todolist(STREAM *output, TODOLIST *todolist) {
   }
 }
 
+void write_todolist(STREAM *output, TODOLIST *todolist) {
+  TASK *task = NULL;
+  stream_printf(output, "%s\n", todolist->title);
+  task = todolist->first;
+  while (task) {
+    if (task->depth) {
+      stream_printf(output, "%*s", 2 * task->depth, "");
+    }
+    stream_printf(output, "[%c] %s%s\n",
+        task->done ? 'X' : ' ', get_prefix(task), task->message);
+    task = task->next;
+  }
+  write_options(output, todolist);
+}
+
 char *stringify_todolist(TODOLIST *todolist) {
-  size_t size = 100;
-  char *str = (char *)malloc(size);
-  STREAM *output = stream_buffer(str, size);
+  STREAM *output = stream_new_buffer(4096);
+  if (!output) {
+    error("Could not allocate memory");
+    return NULL;
+  }
   write_todolist(output, todolist);
-  stream_printf(output, "\0");
-  str = stream_get_content(output);
-  stream_close(output);
-  return str;
+  return stream_close_buffer(output, NULL);
+}
+
+char *stringify_changes(TODOLIST *todolist, size_t min_offset, size_t *offset,
+    size_t *length) {
+  STREAM *output = NULL;
+  TASK *task = todolist->last;
+  size_t start = todolist->clean_end;
+  char *data = NULL;
+  if (todolist->dirty_offset < start) {
+    start = todolist->dirty_offset;
+  }
+  /* Tasks before the first change keep their offsets, and everything after
+   * them is written again. */
+  while (task && (task->offset == NO_OFFSET || task->offset >= start)) {
+    task = task->prev;
+  }
+  if (start > 0) {
+    start = task ? task->offset + 2 * task->depth
+      + strlen(get_prefix(task)) + strlen(task->message) + 5
+      : strlen(todolist->title) + 1;
+  }
+  task = task ? task->next : todolist->first;
+  if (start < min_offset) {
+    start = 0;
+    task = todolist->first;
+  }
+  output = stream_new_buffer(4096);
+  if (!output) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  *offset = start;
+  if (start == 0) {
+    start += stream_printf(output, "%s\n", todolist->title);
+  }
+  for (; task; task = task->next) {
+    task->offset = start;
+    if (task->depth) {
+      start += stream_printf(output, "%*s", 2 * task->depth, "");
+    }
+    start += stream_printf(output, "[%c] %s%s\n",
+        task->done ? 'X' : ' ', get_prefix(task), task->message);
+  }
+  todolist->clean_end = start;
+  todolist->dirty_offset = NO_OFFSET;
+  write_options(output, todolist);
+  data = stream_close_buffer(output, length);
+  if (data) {
+    todolist->file_size = *offset + *length;
+  }
+  else {
+    error("Could not allocate memory");
+  }
+  return data;
+}
+
+#ifdef HAVE_WRITEV
+/* Write all buffers, retrying after partial writes. */
+static int write_buffers(int fd, struct iovec *iov, int count) {
+  ssize_t n;
+  while (count > 0) {
+    n = writev(fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 1;
 }
 
+/* Add a buffer to a batch, writing the batch first if it is full. */
+static int add_buffer(int fd, struct iovec *iov, int *count, const char *data, size_t length) {
+  if (*count == IOV_BATCH) {
+    if (!write_buffers(fd, iov, *count)) {
+      return 0;
+    }
+    *count = 0;
+  }
+  iov[*count].iov_base = (void *)data;
+  iov[*count].iov_len = length;
+  (*count)++;
+  return 1;
+}
+
+/* Add the indentation of a task at some depth to a batch. */
+static int add_indent(int fd, struct iovec *iov, int *count, int depth) {
+  static const char spaces[] = "                                ";
+  size_t length = 2 * depth;
+  while (length > 0) {
+    size_t chunk = length < sizeof(spaces) - 1 ? length : sizeof(spaces) - 1;
+    if (!add_buffer(fd, iov, count, spaces, chunk)) {
+      return 0;
+    }
+    length -= chunk;
+  }
+  return 1;
+}
+
+/* Write a list to a file descriptor without copying the task messages. The
+ * output is identical to that of write_todolist(). */
+static int writev_todolist(int fd, TODOLIST *todolist) {
+  struct iovec iov[IOV_BATCH];
+  int count = 0;
+  int status = 1;
+  size_t length = 0;
+  char *options = NULL;
+  STREAM *buffer = NULL;
+  TASK *task = NULL;
+  buffer = stream_new_buffer(256);
+  if (!buffer) {
+    errno = ENOMEM;
+    return 0;
+  }
+  write_options(buffer, todolist);
+  options = stream_close_buffer(buffer, &length);
+  /* The newline ending a line is written together with the prefix of the
+   * next task, so each task only needs two buffers (three if it has a
+   * priority or is escaped, and more if it is indented). */
+  status = add_buffer(fd, iov, &count, todolist->title, strlen(todolist->title));
+  for (task = todolist->first; status && task; task = task->next) {
+    const char *prefix = task->done ? "\n[X] " : "\n[ ] ";
+    const char *tag = get_prefix(task);
+    if (task->depth) {
+      status = add_buffer(fd, iov, &count, prefix, 1)
+        && add_indent(fd, iov, &count, task->depth)
+        && add_buffer(fd, iov, &count, prefix + 1, 4);
+    }
+    else {
+      status = add_buffer(fd, iov, &count, prefix, 5);
+    }
+    status = status
+      && (!*tag || add_buffer(fd, iov, &count, tag, strlen(tag)))
+      && add_buffer(fd, iov, &count, task->message, strlen(task->message));
+  }
+  if (status) {
+    status = add_buffer(fd, iov, &count, "\n", 1);
+  }
+  if (status && length) {
+    status = add_buffer(fd, iov, &count, options, length);
+  }
+  if (status) {
+    status = write_buffers(fd, iov, count);
+  }
+  free(options);
+  return status;
+}
+#endif
+
 int save_todolist(TODOLIST *todolist, char *filename) {
+#ifdef HAVE_WRITEV
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    error("%s", strerror(errno));
+    return 0;
+  }
+  if (!writev_todolist(fd, todolist)) {
+    error("%s", strerror(errno));
+    close(fd);
+    return 0;
+  }
+  if (close(fd) != 0) {
+    error("%s", strerror(errno));
+    return 0;
+  }
+  return 1;
+#else
   STREAM *file = stream_file(filename, "w");
   if (!file) {
     error("%s", strerror(errno));
@@ -269,4 +956,5 @@ int save_todolist(TODOLIST *todolist, char *filename) {
   write_todolist(file, todolist);
   stream_close(file);
   return 1;
+#endif
 }
@@ -12,14 +12,46 @@
 
 #include "task.h"
 
+/* A list being loaded. */
+typedef struct LOADER LOADER;
+
 /* Load list from file. */
 TODOLIST *load_todolist(char *filename);
+/* Start loading a list from a file. Only the title is read until the rest of
+ * the file is read using continue_load() or finish_load(). */
+TODOLIST *start_load(char *filename, LOADER **loader);
+/* Read up to the given number of lines of a list being loaded. Returns the
+ * number of tasks read so far. */
+size_t continue_load(LOADER *loader, size_t lines);
+/* Whether all lines of a list being loaded have been read. */
+int load_complete(LOADER *loader);
+/* Read the rest of a list being loaded, and free the loader. Returns 0 on
+ * error. */
+int finish_load(LOADER *loader);
+/* Read the rest of a list being loaded, split into the given number of chunks
+ * that are read in parallel (see parse_todolist_chunks()), and free the
+ * loader. */
+int finish_load_chunks(LOADER *loader, size_t chunks);
 /* Save list to file. */
 int save_todolist(TODOLIST *todolist, char *filename);
 
 /* Parse list from string. */
 TODOLIST *parse_todolist(char *source, size_t length);
+/* Parse list from string, split into the given number of chunks that are
+ * read in parallel. Large lists are otherwise split by their size. */
+TODOLIST *parse_todolist_chunks(char *source, size_t length, size_t chunks);
 /* Convert a list back to a string. */
 char *stringify_todolist(TODOLIST *todolist);
 
+/* Convert the part of a list that has changed since it was last loaded or
+ * saved to a string, which replaces the file from *offset. If the changes start
+ * before min_offset, the whole list is converted and *offset is 0. The list is
+ * marked as saved. */
+char *stringify_changes(TODOLIST *todolist, size_t min_offset, size_t *offset,
+    size_t *length);
+/* Record the modification time of the file once a save has finished. */
+void update_file_info(TODOLIST *todolist, const char *filename);
+/* Whether the file hasn't been modified since the list was loaded or saved. */
+int file_unchanged(TODOLIST *todolist, const char *filename);
+
 #endif
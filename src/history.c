@@ -0,0 +1,349 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "stream.h"
+#include "error.h"
+
+/* Default size in bytes of the records at which the oldest steps are
+ * forgotten. */
+#define HISTORY_LIMIT (16 * 1024 * 1024)
+
+/* A recorded change. Part of doubly linked list, oldest first. Inserting and
+ * deleting a task are each other's inverse, so the message, done flag,
+ * priority and depth of the task are stored while it is deleted, i.e. after a deletion
+ * or after undoing an insertion. Likewise, message is the message (or title)
+ * that isn't the current one after an edit. */
+typedef struct RECORD {
+  int type; /* Type of change, see CHANGE. */
+  int step; /* Whether the record is the first of a step. */
+  size_t position; /* As in CHANGE. */
+  size_t old_position; /* As in CHANGE. */
+  int done; /* Done flag of task after the change, or of deleted task. */
+  int priority; /* Priority of task after the change, or of deleted task. */
+  int depth; /* Depth of task after the change, or of deleted task. */
+  char *message; /* Message of deleted task, or other message or title, or
+                    NULL. */
+  struct RECORD *next; /* Next record. */
+  struct RECORD *prev; /* Previous record. */
+} RECORD;
+
+struct HISTORY {
+  RECORD *first; /* Oldest record. */
+  RECORD *last; /* Newest record. */
+  RECORD *current; /* Newest record that hasn't been undone, or NULL. */
+  RECORD *step; /* First record of the step being recorded, or NULL. */
+  size_t size; /* Memory used by the records in bytes. */
+  size_t limit; /* Size at which the oldest steps are forgotten. */
+  int new_step; /* Whether the next record starts a step. */
+  int skip_step; /* Whether the rest of the step isn't recorded, because it
+                    was forgotten. */
+  int applying; /* Whether a step is being undone or redone. */
+};
+
+static size_t message_size(const char *message) {
+  return message ? strlen(message) + 1 : 0;
+}
+
+static void free_record(HISTORY *history, RECORD *record) {
+  history->size -= sizeof(RECORD) + message_size(record->message);
+  free(record->message);
+  free(record);
+}
+
+/* Replace the message of a record, which is copied. Returns 0 on error. */
+static int set_message(HISTORY *history, RECORD *record, const char *message) {
+  char *copy = NULL;
+  if (message) {
+    copy = string_printf("%s", message);
+    if (!copy) {
+      error("Could not allocate memory");
+      return 0;
+    }
+  }
+  history->size -= message_size(record->message);
+  history->size += message_size(copy);
+  free(record->message);
+  record->message = copy;
+  return 1;
+}
+
+/* Forget the records after the current one, which can no longer be redone. */
+static void forget_redo(HISTORY *history) {
+  RECORD *record = history->current ? history->current->next : history->first;
+  RECORD *next = NULL;
+  for (; record; record = next) {
+    next = record->next;
+    free_record(history, record);
+  }
+  history->last = history->current;
+  if (history->current) {
+    history->current->next = NULL;
+  }
+  else {
+    history->first = NULL;
+  }
+}
+
+/* Forget the oldest step. */
+static void forget_step(HISTORY *history) {
+  RECORD *record = NULL;
+  do {
+    record = history->first;
+    history->first = record->next;
+    if (history->first) {
+      history->first->prev = NULL;
+    }
+    else {
+      history->last = NULL;
+    }
+    if (history->current == record) {
+      history->current = NULL;
+    }
+    if (history->step == record) {
+      /* The rest of the step can't be undone on its own. */
+      history->step = NULL;
+      history->skip_step = 1;
+    }
+    free_record(history, record);
+  } while (history->first && !history->first->step);
+}
+
+static void record_change(TODOLIST *list, CHANGE *change, void *data) {
+  HISTORY *history = (HISTORY *)data;
+  RECORD *record = NULL;
+  (void)list;
+  if (history->applying || change->type == CHANGE_OPTION) {
+    return;
+  }
+  if (history->new_step) {
+    history->new_step = 0;
+    history->skip_step = 0;
+    history->step = NULL;
+  }
+  if (history->skip_step) {
+    return;
+  }
+  forget_redo(history);
+  record = (RECORD *)malloc(sizeof(RECORD));
+  if (!record) {
+    error("Could not allocate memory");
+    history->skip_step = 1;
+    return;
+  }
+  record->type = change->type;
+  record->step = !history->step;
+  record->position = change->position;
+  record->old_position = change->old_position;
+  record->done = change->task ? change->task->done : 0;
+  record->priority = change->task ? change->task->priority : 0;
+  record->depth = change->task ? change->task->depth : 0;
+  record->message = NULL;
+  record->next = NULL;
+  record->prev = history->last;
+  if (history->last) {
+    history->last->next = record;
+  }
+  else {
+    history->first = record;
+  }
+  history->last = record;
+  history->current = record;
+  if (!history->step) {
+    history->step = record;
+  }
+  history->size += sizeof(RECORD);
+  switch (change->type) {
+    case CHANGE_DELETE:
+      set_message(history, record, change->task->message);
+      break;
+    case CHANGE_MESSAGE:
+    case CHANGE_TITLE:
+      set_message(history, record, change->old_value);
+      break;
+  }
+  while (history->first && history->size > history->limit) {
+    forget_step(history);
+  }
+}
+
+/* Undo a recorded change, or redo it if undo is 0. Returns 0 if the list
+ * doesn't match the record, or on error. */
+static int apply_record(HISTORY *history, TODOLIST *list, RECORD *record,
+    int undo, size_t *position) {
+  TASK *task = NULL;
+  char *message = NULL;
+  size_t from = undo ? record->position : record->old_position;
+  size_t to = undo ? record->old_position : record->position;
+  int type = record->type;
+  if (undo && type == CHANGE_INSERT) {
+    type = CHANGE_DELETE;
+  }
+  else if (undo && type == CHANGE_DELETE) {
+    type = CHANGE_INSERT;
+  }
+  if (type != CHANGE_TITLE) {
+    *position = record->position;
+  }
+  if (type != CHANGE_TITLE && type != CHANGE_INSERT && type != CHANGE_MOVE) {
+    task = get_task_at(list, record->position);
+    if (!task) {
+      return 0;
+    }
+  }
+  switch (type) {
+    case CHANGE_INSERT:
+      if (!record->message || record->position > list->task_count) {
+        return 0;
+      }
+      task = get_task_at(list, record->position);
+      if (task) {
+        insert_task(list, task, record->message, record->done,
+            record->priority, record->depth);
+      }
+      else {
+        add_task(list, record->message, record->done, record->priority,
+            record->depth);
+      }
+      /* The message now belongs to the list. */
+      history->size -= message_size(record->message);
+      record->message = NULL;
+      return 1;
+    case CHANGE_DELETE:
+      if (!set_message(history, record, task->message)) {
+        return 0;
+      }
+      record->done = task->done;
+      record->priority = task->priority;
+      record->depth = task->depth;
+      delete_task(task, list);
+      return 1;
+    case CHANGE_MOVE:
+      task = get_task_at(list, from);
+      if (!task || to >= list->task_count) {
+        return 0;
+      }
+      move_task(list, task, get_task_at(list, to > from ? to + 1 : to));
+      *position = to;
+      return 1;
+    case CHANGE_DONE:
+      set_task_done(list, task, undo ? !record->done : record->done);
+      return 1;
+    case CHANGE_PRIORITY:
+      set_task_priority(list, task,
+          undo ? (int)record->old_position : record->priority);
+      return 1;
+    case CHANGE_DEPTH:
+      set_task_depth(list, task,
+          undo ? (int)record->old_position : record->depth);
+      return 1;
+    case CHANGE_MESSAGE:
+    case CHANGE_TITLE:
+      /* The current message and the recorded one are swapped. */
+      message = record->message;
+      record->message = NULL;
+      history->size -= message_size(message);
+      if (!message || !set_message(history, record,
+            task ? task->message : list->title)) {
+        free(message);
+        return 0;
+      }
+      if (task) {
+        set_task_message(list, task, message);
+      }
+      else {
+        set_title(list, message);
+      }
+      return 1;
+  }
+  return 0;
+}
+
+/* Forget the history after a failure to undo or redo a step, which means that
+ * the records no longer match the list. */
+static void reset_history(HISTORY *history) {
+  history->current = NULL;
+  forget_redo(history);
+  history->step = NULL;
+  history->new_step = 1;
+}
+
+int undo_history(HISTORY *history, TODOLIST *todolist, size_t *position) {
+  RECORD *record = history->current;
+  int status = 1;
+  if (!record) {
+    return 0;
+  }
+  history->applying = 1;
+  do {
+    record = history->current;
+    status = apply_record(history, todolist, record, 1, position);
+    history->current = record->prev;
+  } while (status && !record->step);
+  history->applying = 0;
+  history->new_step = 1;
+  if (!status) {
+    reset_history(history);
+  }
+  return status;
+}
+
+int redo_history(HISTORY *history, TODOLIST *todolist, size_t *position) {
+  RECORD *record = history->current ? history->current->next : history->first;
+  int status = 1;
+  if (!record) {
+    return 0;
+  }
+  history->applying = 1;
+  do {
+    status = apply_record(history, todolist, record, 0, position);
+    history->current = record;
+    record = record->next;
+  } while (status && record && !record->step);
+  history->applying = 0;
+  history->new_step = 1;
+  if (!status) {
+    reset_history(history);
+  }
+  return status;
+}
+
+HISTORY *open_history(TODOLIST *todolist) {
+  char *value = NULL;
+  HISTORY *history = (HISTORY *)malloc(sizeof(HISTORY));
+  if (!history) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  history->first = NULL;
+  history->last = NULL;
+  history->current = NULL;
+  history->step = NULL;
+  history->size = 0;
+  history->limit = HISTORY_LIMIT;
+  history->new_step = 1;
+  history->skip_step = 0;
+  history->applying = 0;
+  if ((value = get_option(todolist, "undolimit"))) {
+    history->limit = strtoul(value, NULL, 10);
+  }
+  add_listener(todolist, record_change, history);
+  return history;
+}
+
+void next_history_step(HISTORY *history) {
+  history->new_step = 1;
+}
+
+void close_history(HISTORY *history, TODOLIST *todolist) {
+  remove_listener(todolist, record_change, history);
+  history->current = NULL;
+  forget_redo(history);
+  free(history);
+}
@@ -0,0 +1,39 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Undo and redo of changes to a list. Each change is recorded along with what
+ * is needed to reverse it, e.g. the message of a deleted task or the old
+ * message of an edited task, so the memory used is proportional to the changes
+ * rather than to the size of the list.
+ *
+ * Changes are grouped in steps, e.g. all changes made by a command, which are
+ * undone and redone at once. The oldest steps are forgotten once the records
+ * take up more than a limit (16 MiB, or the number of bytes in the undolimit
+ * option). Changes to options are not recorded. */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "task.h"
+
+/* History type */
+typedef struct HISTORY HISTORY;
+
+/* Start recording changes to a list. */
+HISTORY *open_history(TODOLIST *todolist);
+/* Start a new step. The changes made until the next call are undone
+ * together. */
+void next_history_step(HISTORY *history);
+/* Undo the last step that hasn't been undone. Returns 0 if there is nothing to
+ * undo, or on error. Otherwise position is set to the position of the last
+ * task that was changed. */
+int undo_history(HISTORY *history, TODOLIST *todolist, size_t *position);
+/* Redo the last step that was undone. Returns 0 if there is nothing to redo,
+ * or on error. Otherwise position is set as for undo_history(). */
+int redo_history(HISTORY *history, TODOLIST *todolist, size_t *position);
+/* Stop recording changes and forget the history. */
+void close_history(HISTORY *history, TODOLIST *todolist);
+
+#endif
@@ -0,0 +1,367 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+#include "stream.h"
+#include "writer.h"
+#include "error.h"
+
+/* Default size in bytes at which the journal is compacted. */
+#define JOURNAL_LIMIT (1024 * 1024)
+
+/* The journal is a text file with one record per line:
+ *   ctodo-journal <generation>        (first line)
+ *   i <position> <done> <message>     task inserted
+ *   d <position>                      task deleted
+ *   v <old position> <position>       task moved
+ *   x <position> <done>               task checked or unchecked
+ *   e <position> <message>            message changed
+ *   p <position> <priority>           priority changed (also written after
+ *                                     "i" if the task has a priority)
+ *   l <position> <depth>              depth changed (also written after "i"
+ *                                     if the task is a subtask)
+ *   t <title>                         title changed
+ *   o <key>=<value>                   option set
+ * Messages and titles never contain newlines. In option keys and values,
+ * backslash, newline and '=' are escaped with a backslash (newline as "\n"). */
+struct JOURNAL {
+  char *filename; /* Name of journal file. */
+  char *list_filename; /* Name of list file. */
+  STREAM *pending; /* Records that haven't been saved yet. */
+  size_t size; /* Size of journal file after the queued writes. */
+  size_t limit; /* Size at which the journal is compacted. */
+  unsigned long generation; /* Journal generation. */
+  int reset; /* Whether the journal file must be rewritten. */
+  int compact; /* Whether the full list must be saved. */
+};
+
+static void write_escaped(STREAM *output, const char *str, int escape_equals) {
+  for (; *str; str++) {
+    if (*str == '\n') {
+      stream_write("\\n", 1, 2, output);
+      continue;
+    }
+    if (*str == '\\' || (escape_equals && *str == '=')) {
+      stream_putc('\\', output);
+    }
+    stream_putc(*str, output);
+  }
+}
+
+/* Unescape an option key or value in place. Stops at an unescaped '=' if
+ * stop_at_equals is set. Returns a pointer to the character after the string. */
+static char *read_escaped(char *str, int stop_at_equals) {
+  char *dest = str;
+  while (*str && !(stop_at_equals && *str == '=')) {
+    if (*str == '\\' && str[1]) {
+      str++;
+      *(dest++) = *str == 'n' ? '\n' : *str;
+    }
+    else {
+      *(dest++) = *str;
+    }
+    str++;
+  }
+  if (*str) {
+    str++;
+  }
+  *dest = '\0';
+  return str;
+}
+
+static void record_change(TODOLIST *list, CHANGE *change, void *data) {
+  JOURNAL *journal = (JOURNAL *)data;
+  STREAM *out = journal->pending;
+  switch (change->type) {
+    case CHANGE_INSERT:
+      stream_printf(out, "i %lu %d %s\n", (unsigned long)change->position,
+          change->task->done, change->task->message);
+      if (change->task->priority) {
+        stream_printf(out, "p %lu %d\n", (unsigned long)change->position,
+            change->task->priority);
+      }
+      if (change->task->depth) {
+        stream_printf(out, "l %lu %d\n", (unsigned long)change->position,
+            change->task->depth);
+      }
+      break;
+    case CHANGE_DELETE:
+      stream_printf(out, "d %lu\n", (unsigned long)change->position);
+      break;
+    case CHANGE_MOVE:
+      stream_printf(out, "v %lu %lu\n", (unsigned long)change->old_position,
+          (unsigned long)change->position);
+      break;
+    case CHANGE_DONE:
+      stream_printf(out, "x %lu %d\n", (unsigned long)change->position,
+          change->task->done);
+      break;
+    case CHANGE_PRIORITY:
+      stream_printf(out, "p %lu %d\n", (unsigned long)change->position,
+          change->task->priority);
+      break;
+    case CHANGE_DEPTH:
+      stream_printf(out, "l %lu %d\n", (unsigned long)change->position,
+          change->task->depth);
+      break;
+    case CHANGE_MESSAGE:
+      stream_printf(out, "e %lu %s\n", (unsigned long)change->position,
+          change->task->message);
+      break;
+    case CHANGE_TITLE:
+      stream_printf(out, "t %s\n", list->title);
+      break;
+    case CHANGE_OPTION:
+      stream_printf(out, "o ");
+      write_escaped(out, change->old_value, 1);
+      stream_putc('=', out);
+      write_escaped(out, get_option(list, change->old_value), 0);
+      stream_putc('\n', out);
+      break;
+  }
+}
+
+/* Read a number followed by a space or the end of the record. */
+static int read_number(char **str, unsigned long *number) {
+  char *end = NULL;
+  *number = strtoul(*str, &end, 10);
+  if (end == *str || (*end != ' ' && *end != '\0')) {
+    return 0;
+  }
+  *str = *end ? end + 1 : end;
+  return 1;
+}
+
+/* Apply a record to a list. Returns 0 if the record is invalid. */
+static int replay_record(TODOLIST *list, char *record) {
+  char *str = record + 2;
+  char *value = NULL;
+  unsigned long position, other;
+  TASK *task = NULL;
+  if (record[0] == '\0' || record[1] != ' ') {
+    return 0;
+  }
+  switch (record[0]) {
+    case 'i':
+      if (!read_number(&str, &position) || !read_number(&str, &other)) {
+        return 0;
+      }
+      value = string_printf("%s", str);
+      task = get_task_at(list, position);
+      if (task) {
+        insert_task(list, task, value, other, 0, 0);
+      }
+      else if (position == get_task_position(list, NULL)) {
+        add_task(list, value, other, 0, 0);
+      }
+      else {
+        free(value);
+        return 0;
+      }
+      return 1;
+    case 'd':
+      if (!read_number(&str, &position) || !(task = get_task_at(list, position))) {
+        return 0;
+      }
+      delete_task(task, list);
+      return 1;
+    case 'v':
+      if (!read_number(&str, &other) || !read_number(&str, &position)
+          || !(task = get_task_at(list, other))) {
+        return 0;
+      }
+      /* The task ends up before the task that is at the new position once the
+       * moved task has been removed. */
+      if (position > other) {
+        move_task(list, task, get_task_at(list, position + 1));
+      }
+      else if (position < other) {
+        move_task(list, task, get_task_at(list, position));
+      }
+      return 1;
+    case 'x':
+      if (!read_number(&str, &position) || !read_number(&str, &other)
+          || !(task = get_task_at(list, position))) {
+        return 0;
+      }
+      set_task_done(list, task, other != 0);
+      return 1;
+    case 'p':
+      if (!read_number(&str, &position) || !read_number(&str, &other)
+          || other > PRIORITY_MAX || !(task = get_task_at(list, position))) {
+        return 0;
+      }
+      set_task_priority(list, task, (int)other);
+      return 1;
+    case 'l':
+      if (!read_number(&str, &position) || !read_number(&str, &other)
+          || other > DEPTH_MAX || !(task = get_task_at(list, position))) {
+        return 0;
+      }
+      set_task_depth(list, task, (int)other);
+      return 1;
+    case 'e':
+      if (!read_number(&str, &position) || !(task = get_task_at(list, position))) {
+        return 0;
+      }
+      set_task_message(list, task, string_printf("%s", str));
+      return 1;
+    case 't':
+      set_title(list, string_printf("%s", str));
+      return 1;
+    case 'o':
+      value = read_escaped(str, 1);
+      read_escaped(value, 0);
+      set_option(list, str, value);
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Replay the journal file. Marks the journal for compaction if it contains an
+ * invalid record, and for reset if it doesn't exist or belongs to another
+ * generation of the list. */
+static void replay_journal(JOURNAL *journal, TODOLIST *list) {
+  STREAM *input = stream_mmap(journal->filename);
+  const char *line = NULL;
+  const char *end = NULL;
+  char *record = NULL;
+  size_t length;
+  unsigned long generation;
+  journal->reset = 1;
+  if (!input) {
+    return;
+  }
+  line = stream_line(input, &length);
+  record = line ? string_printf("%.*s", (int)length, line) : NULL;
+  if (record && sscanf(record, "ctodo-journal %lu", &generation) == 1
+      && generation == journal->generation) {
+    journal->reset = 0;
+    journal->size = stream_get_size(input);
+    if (journal->size) {
+      end = stream_get_content(input) + journal->size;
+    }
+    while ((line = stream_line(input, &length))) {
+      free(record);
+      record = string_printf("%.*s", (int)length, line);
+      /* The last record is incomplete if the journal was not fully written. */
+      if (!record || (end && line + length >= end)
+          || !replay_record(list, record)) {
+        journal->compact = 1;
+        break;
+      }
+    }
+  }
+  free(record);
+  stream_close(input);
+}
+
+JOURNAL *open_journal(TODOLIST *todolist, const char *filename, int replay) {
+  char *value = NULL;
+  JOURNAL *journal = (JOURNAL *)malloc(sizeof(JOURNAL));
+  if (!journal) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  journal->filename = string_printf("%s.journal", filename);
+  journal->list_filename = string_printf("%s", filename);
+  journal->pending = stream_new_buffer(256);
+  journal->size = 0;
+  journal->limit = JOURNAL_LIMIT;
+  journal->generation = 0;
+  journal->reset = 1;
+  journal->compact = !replay;
+  if (!journal->filename || !journal->list_filename || !journal->pending) {
+    close_journal(journal, NULL);
+    error("Could not allocate memory");
+    return NULL;
+  }
+  if ((value = get_option(todolist, "journalgen"))) {
+    journal->generation = strtoul(value, NULL, 10);
+  }
+  if ((value = get_option(todolist, "journallimit"))) {
+    journal->limit = strtoul(value, NULL, 10);
+  }
+  if (replay) {
+    replay_journal(journal, todolist);
+  }
+  add_listener(todolist, record_change, journal);
+  return journal;
+}
+
+int save_journal(JOURNAL *journal, TODOLIST *todolist) {
+  char *data = NULL;
+  char generation[32];
+  size_t length = 0;
+  STREAM *pending = stream_new_buffer(256);
+  if (!pending) {
+    error("Could not allocate memory");
+    return 0;
+  }
+  data = stream_close_buffer(journal->pending, &length);
+  journal->pending = pending;
+  if (journal->compact || journal->size + length > journal->limit) {
+    /* The full list includes the pending changes, so they are discarded along
+     * with the record of the new generation. */
+    free(data);
+    journal->generation++;
+    sprintf(generation, "%lu", journal->generation);
+    set_option(todolist, "journalgen", generation);
+    free(stream_close_buffer(journal->pending, NULL));
+    journal->pending = pending = stream_new_buffer(256);
+    if (!pending) {
+      error("Could not allocate memory");
+      return 0;
+    }
+    if (!save_todolist_async(todolist, journal->list_filename)) {
+      return 0;
+    }
+    journal->reset = 1;
+    journal->compact = 0;
+    length = 0;
+    data = NULL;
+  }
+  if (journal->reset) {
+    pending = stream_new_buffer(length + 64);
+    if (!pending) {
+      free(data);
+      error("Could not allocate memory");
+      return 0;
+    }
+    stream_printf(pending, "ctodo-journal %lu\n", journal->generation);
+    if (data) {
+      stream_write(data, 1, length, pending);
+      free(data);
+    }
+    data = stream_close_buffer(pending, &length);
+    journal->reset = 0;
+    journal->size = length;
+    return write_file_async(journal->filename, data, length, WRITE_REPLACE);
+  }
+  if (length == 0) {
+    free(data);
+    return 1;
+  }
+  journal->size += length;
+  return write_file_async(journal->filename, data, length, WRITE_APPEND);
+}
+
+void close_journal(JOURNAL *journal, TODOLIST *todolist) {
+  if (todolist) {
+    remove_listener(todolist, record_change, journal);
+  }
+  if (journal->pending) {
+    free(stream_close_buffer(journal->pending, NULL));
+  }
+  free(journal->filename);
+  free(journal->list_filename);
+  free(journal);
+}
@@ -0,0 +1,38 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Implements an optional journal mode, in which saving a list only appends
+ * the changes made since the last save to a sidecar file, e.g. todo.txt.journal,
+ * instead of rewriting the whole list.
+ *
+ * Use by adding the following option to a ctodo file:
+ *   # journal=1
+ *
+ * When the list is loaded, the journal is replayed on top of it. Once the
+ * journal grows past a limit (1 MiB, or the number of bytes in the
+ * journallimit option), it is compacted by saving the full list and starting
+ * a new journal. The generation of the journal is stored in the journalgen
+ * option, so a journal that was compacted into the list is never replayed
+ * twice. */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "task.h"
+
+/* Journal type */
+typedef struct JOURNAL JOURNAL;
+
+/* Start recording changes to a list saved in filename. If replay is set, the
+ * list has just been loaded from filename, and the changes in the journal are
+ * applied to it. Otherwise the next save writes the full list. */
+JOURNAL *open_journal(TODOLIST *todolist, const char *filename, int replay);
+/* Queue the recorded changes to be appended to the journal (see writer.h).
+ * Nothing is queued if no changes were recorded since the last save. */
+int save_journal(JOURNAL *journal, TODOLIST *todolist);
+/* Stop recording changes. Unsaved changes are discarded. */
+void close_journal(JOURNAL *journal, TODOLIST *todolist);
+
+#endif
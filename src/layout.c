@@ -0,0 +1,183 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <ncurses.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "layout.h"
+#include "error.h"
+
+/* Number of layouts in the cache, a power of two. Each key has a single slot,
+ * so a few times the number of rows of a screen is enough. */
+#define LAYOUT_SLOTS 512
+
+/* A cached layout. */
+typedef struct SLOT {
+  const char *key; /* Title or message, or NULL if the slot is unused. */
+  size_t length; /* Length of the string. */
+  int width; /* Width the string is wrapped at. */
+  LAYOUT layout; /* The layout. */
+  size_t capacity; /* Number of offsets that fit in layout.starts. */
+} SLOT;
+
+struct LAYOUTS {
+  SLOT slots[LAYOUT_SLOTS]; /* Layouts by hash of key. */
+  SLOT scratch; /* Layout of a string that isn't cached. */
+  WINDOW *window; /* Window that isn't shown, for measuring characters. */
+};
+
+static SLOT *get_slot(LAYOUTS *layouts, const char *key) {
+  uintptr_t hash = (uintptr_t)key;
+  hash ^= hash >> 17;
+  hash *= 0x9e3779b1u;
+  return &layouts->slots[(hash >> 7) & (LAYOUT_SLOTS - 1)];
+}
+
+/* Number of columns a character takes up when it is drawn, except that tabs
+ * are drawn as spaces. */
+static int char_width(LAYOUTS *layouts, wchar_t wc) {
+  int x, y;
+  if (wc == '\t' || (wc >= ' ' && wc <= '~')) {
+    return 1;
+  }
+  /* Finds the width of the character by letting ncurses print it, since e.g.
+   * control characters are drawn as "^A". */
+  mvwprintw(layouts->window, 0, 0, "%C", wc);
+  getyx(layouts->window, y, x);
+  (void)y;
+  return x;
+}
+
+/* Append an offset to the starts of a layout. Returns 0 on error. */
+static int add_start(SLOT *slot, size_t count, size_t offset) {
+  size_t *starts = NULL;
+  if (count >= slot->capacity) {
+    starts = (size_t *)realloc(slot->layout.starts,
+        2 * (count + 1) * sizeof(size_t));
+    if (!starts) {
+      error("Could not allocate memory");
+      return 0;
+    }
+    slot->layout.starts = starts;
+    slot->capacity = 2 * (count + 1);
+  }
+  slot->layout.starts[count] = offset;
+  return 1;
+}
+
+/* Wrap a string, which ends at the first invalid character. A row is wrapped
+ * before the first character that doesn't fit, unless it is the only one. */
+static int wrap(LAYOUTS *layouts, SLOT *slot, const char *str, size_t length,
+    int width) {
+  mbstate_t shift_state;
+  wchar_t wc;
+  size_t i, wc_len, count = 0;
+  int x = 0, w;
+  memset(&shift_state, '\0', sizeof shift_state);
+  if (!add_start(slot, count++, 0)) {
+    return 0;
+  }
+  for (i = 0; i < length; i += wc_len) {
+    wc_len = mbrtowc(&wc, str + i, length - i, &shift_state);
+    if (!wc_len || wc_len == (size_t)-1 || wc_len == (size_t)-2) {
+      break;
+    }
+    w = char_width(layouts, wc);
+    if (x > 0 && x + w > width) {
+      if (!add_start(slot, count++, i)) {
+        return 0;
+      }
+      x = 0;
+    }
+    x += w;
+  }
+  if (!add_start(slot, count, i)) {
+    return 0;
+  }
+  slot->layout.rows = count;
+  return 1;
+}
+
+static void update_layouts(TODOLIST *list, CHANGE *change, void *data) {
+  LAYOUTS *layouts = (LAYOUTS *)data;
+  const char *key = NULL;
+  SLOT *slot = NULL;
+  (void)list;
+  switch (change->type) {
+    case CHANGE_MESSAGE:
+    case CHANGE_TITLE:
+      /* The old message may have been freed, and its address reused. */
+      key = change->old_value;
+      break;
+    case CHANGE_DELETE:
+      key = change->task->message;
+      break;
+    default:
+      return;
+  }
+  slot = get_slot(layouts, key);
+  if (slot->key == key) {
+    slot->key = NULL;
+  }
+}
+
+LAYOUTS *open_layouts(TODOLIST *todolist) {
+  LAYOUTS *layouts = (LAYOUTS *)calloc(1, sizeof(LAYOUTS));
+  if (!layouts) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  layouts->window = newwin(1, 32, 0, 0);
+  if (!layouts->window) {
+    error("Could not create window");
+    free(layouts);
+    return NULL;
+  }
+  add_listener(todolist, update_layouts, layouts);
+  return layouts;
+}
+
+const LAYOUT *get_layout(LAYOUTS *layouts, const char *key, const char *str,
+    int width) {
+  SLOT *slot = key ? get_slot(layouts, key) : &layouts->scratch;
+  size_t length = strlen(str);
+  if (width < 1) {
+    width = 1;
+  }
+  if (key && slot->key == key && slot->width == width
+      && slot->length == length) {
+    return &slot->layout;
+  }
+  slot->key = NULL;
+  if (!wrap(layouts, slot, str, length, width)) {
+    return NULL;
+  }
+  slot->key = key;
+  slot->length = length;
+  slot->width = width;
+  return &slot->layout;
+}
+
+void clear_layouts(LAYOUTS *layouts) {
+  size_t i;
+  for (i = 0; i < LAYOUT_SLOTS; i++) {
+    layouts->slots[i].key = NULL;
+  }
+}
+
+void close_layouts(LAYOUTS *layouts, TODOLIST *todolist) {
+  size_t i;
+  remove_listener(todolist, update_layouts, layouts);
+  for (i = 0; i < LAYOUT_SLOTS; i++) {
+    free(layouts->slots[i].layout.starts);
+  }
+  free(layouts->scratch.layout.starts);
+  delwin(layouts->window);
+  free(layouts);
+}
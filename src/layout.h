@@ -0,0 +1,47 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Wrapped layouts of the title and task messages of a list. A string is
+ * wrapped into rows that are at most a number of columns wide, where the width
+ * of each character is measured in a window that isn't shown, so the number of
+ * rows a task takes up is known without drawing it. The screen must have been
+ * initialized with initscr().
+ *
+ * The layouts of recently drawn strings are cached by the address of the
+ * message (or title) and the width. A layout is removed from the cache when
+ * its message is replaced or its task is deleted. */
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "task.h"
+
+/* The rows of a wrapped string. */
+typedef struct LAYOUT {
+  int rows; /* Number of rows, at least one. */
+  size_t *starts; /* Offset in the string of the start of each row, followed by
+                     the end of the last row. Tabs are shown as spaces. */
+} LAYOUT;
+
+/* Layout cache type */
+typedef struct LAYOUTS LAYOUTS;
+
+/* Start keeping track of changes to a list for caching the layouts of its
+ * title and messages. */
+LAYOUTS *open_layouts(TODOLIST *todolist);
+/* Get the layout of a string wrapped at a width of at least one column. The
+ * layout is cached under key, which is the title or the message of a task
+ * that str begins with. The rest of str, e.g. a count of subtasks, must
+ * consist of characters that are one column wide, so only its length is
+ * compared. The layout isn't cached if key is NULL. Returns NULL on error.
+ * The layout is valid until the next call. */
+const LAYOUT *get_layout(LAYOUTS *layouts, const char *key, const char *str,
+    int width);
+/* Remove all layouts from the cache, e.g. when the terminal is resized. */
+void clear_layouts(LAYOUTS *layouts);
+/* Stop keeping track of changes to a list and delete the cache. */
+void close_layouts(LAYOUTS *layouts, TODOLIST *todolist);
+
+#endif
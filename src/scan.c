@@ -0,0 +1,70 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <string.h>
+
+#include "scan.h"
+#include "task.h"
+
+/* Whether c is a whitespace character other than newline. */
+static int is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *skip_blank(const char *pos, const char *end) {
+  while (pos < end && is_blank(*pos)) {
+    pos++;
+  }
+  return pos;
+}
+
+void classify_line(LINE *line, const char *start, size_t length) {
+  const char *end = start + length;
+  const char *pos = start;
+  int indent = 0;
+  /* Tasks are indented by spaces and tabs, where a tab counts as two
+   * spaces. */
+  for (; pos < end && (*pos == ' ' || *pos == '\t'); pos++) {
+    indent += *pos == '\t' ? 2 : 1;
+  }
+  pos = skip_blank(pos, end);
+  line->start = start;
+  line->length = length;
+  line->type = LINE_OTHER;
+  line->done = 0;
+  line->depth = indent / 2 > DEPTH_MAX ? DEPTH_MAX : indent / 2;
+  line->canonical = 0;
+  line->text = NULL;
+  line->text_length = 0;
+  if (pos < end && *pos == '#') {
+    line->type = LINE_OPTIONS;
+    line->text = pos + 1;
+    line->text_length = end - line->text;
+    return;
+  }
+  if (end - pos < 3 || pos[0] != '[' || pos[2] != ']') {
+    return;
+  }
+  switch (pos[1]) {
+    case 'X':
+    case 'x':
+      line->done = 1;
+      break;
+    case ' ':
+      break;
+    default:
+      return;
+  }
+  line->type = LINE_TASK;
+  /* Saved as "[X] message" or "[ ] message" after two spaces for each level,
+   * where message (including its priority, if any) doesn't start with
+   * whitespace. */
+  line->canonical = pos == start + 2 * line->depth
+    && memchr(start, '\t', pos - start) == NULL && pos[1] != 'x'
+    && end - pos >= 4 && pos[3] == ' ' && (end - pos == 4 || !is_blank(pos[4]));
+  line->text = skip_blank(pos + 3, end);
+  line->text_length = end - line->text;
+}
@@ -0,0 +1,35 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Classifies the lines of a ctodo file. */
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Line types. */
+#define LINE_OTHER 0 /* A line that is ignored. */
+#define LINE_TASK 1 /* A task, e.g. "[X] message", indented by two spaces
+                       for each level if it is a subtask. */
+#define LINE_OPTIONS 2 /* Options, e.g. "# key=value". */
+
+/* A line of a ctodo file. */
+typedef struct LINE {
+  const char *start; /* Start of line. */
+  size_t length; /* Length of line excluding the newline. */
+  int type; /* LINE_OTHER, LINE_TASK or LINE_OPTIONS. */
+  int done; /* Whether the task is done. */
+  int depth; /* Depth of the task, i.e. its indentation, where a tab or two
+                spaces is a level. */
+  int canonical; /* Whether the task is written exactly as it would be saved. */
+  const char *text; /* Task message, or options following '#'. */
+  size_t text_length; /* Length of text. */
+} LINE;
+
+/* Classify a line, given without its newline. */
+void classify_line(LINE *line, const char *start, size_t length);
+
+#endif
@@ -0,0 +1,567 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+
+#include "search.h"
+#include "error.h"
+
+/* Initial number of buckets in the trigram table, a power of two. */
+#define SEARCH_BUCKETS 1024
+
+/* If more than one in this many tasks contain each trigram of a query, the
+ * tasks are checked in order instead, since a match is likely to be near. */
+#define SEARCH_SCAN_RATIO 16
+
+/* Text converted to lower case characters. */
+typedef struct FOLDED {
+  uint32_t *chars; /* Characters. */
+  size_t length; /* Number of characters. */
+  size_t size; /* Size of chars. */
+} FOLDED;
+
+struct QUERY {
+  FOLDED query; /* Query. */
+  FOLDED text; /* Buffer for the strings that are matched. */
+};
+
+/* The tasks containing a trigram. Stored in the trigram table. */
+typedef struct POSTINGS {
+  uint64_t trigram; /* Trigram (see get_trigram()), or 0 if the bucket is
+                       empty. */
+  uint32_t *ids; /* Identifiers of the tasks, in increasing order. */
+  uint32_t count; /* Number of identifiers. */
+  uint32_t size; /* Size of ids. */
+} POSTINGS;
+
+struct SEARCH {
+  int built; /* Whether the index has been built. */
+  POSTINGS *table; /* Trigram table, using linear probing. */
+  size_t buckets; /* Number of buckets in table, a power of two. */
+  size_t trigrams; /* Number of trigrams in table. */
+  TASK **tasks; /* Task with each identifier, or NULL if it has been deleted or
+                   edited since it was added. */
+  size_t tasks_size; /* Size of tasks. */
+  uint32_t next_id; /* Next identifier. Identifiers are never reused, so the
+                       identifiers of a trigram stay in increasing order, and
+                       an edited task gets a new one. 0 isn't used. */
+  size_t stale; /* Number of identifiers that no longer refer to a task. */
+  FOLDED text; /* Buffer for messages. */
+  uint64_t *keys; /* Buffer for the trigrams of a message. */
+  size_t keys_size; /* Size of keys. */
+};
+
+/* Decode a UTF-8 character and advance pos past it. Invalid bytes are decoded
+ * one at a time, as characters from 0xDC80 to 0xDCFF, which don't occur in
+ * valid UTF-8. */
+static uint32_t decode_char(const unsigned char **pos) {
+  const unsigned char *str = *pos;
+  uint32_t c = str[0];
+  int length, i;
+  if (c < 0x80) {
+    *pos = str + 1;
+    return c;
+  }
+  if (c >= 0xc2 && c < 0xe0) {
+    length = 1;
+    c &= 0x1f;
+  }
+  else if (c >= 0xe0 && c < 0xf0) {
+    length = 2;
+    c &= 0x0f;
+  }
+  else if (c >= 0xf0 && c < 0xf5) {
+    length = 3;
+    c &= 0x07;
+  }
+  else {
+    length = 0;
+  }
+  for (i = 1; i <= length; i++) {
+    if ((str[i] & 0xc0) != 0x80) {
+      length = 0;
+      break;
+    }
+    c = c << 6 | (str[i] & 0x3f);
+  }
+  if (!length || c > 0x10ffff) {
+    *pos = str + 1;
+    return 0xdc00 + str[0];
+  }
+  *pos = str + length + 1;
+  return c;
+}
+
+/* Decode text and convert it to lower case. Returns 0 on error. */
+static int fold_text(const char *text, FOLDED *folded) {
+  const unsigned char *pos = (const unsigned char *)text;
+  size_t size = strlen(text) + 1;
+  uint32_t *chars = NULL;
+  uint32_t c;
+  if (folded->size < size) {
+    chars = (uint32_t *)realloc(folded->chars, size * sizeof(uint32_t));
+    if (!chars) {
+      error("Could not allocate memory");
+      return 0;
+    }
+    folded->chars = chars;
+    folded->size = size;
+  }
+  folded->length = 0;
+  while (*pos) {
+    c = decode_char(&pos);
+    if (c < 0x80) {
+      if (c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+      }
+    }
+    else if (c < 0xdc80 || c > 0xdcff) {
+      c = towlower(c);
+    }
+    folded->chars[folded->length++] = c;
+  }
+  return 1;
+}
+
+/* Whether folded text contains a folded query. */
+static int contains(const FOLDED *text, const FOLDED *query) {
+  size_t i, j;
+  for (i = 0; i + query->length <= text->length; i++) {
+    for (j = 0; j < query->length && text->chars[i + j] == query->chars[j];
+        j++) {
+    }
+    if (j == query->length) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Get the trigram starting at a character. Characters are at most 21 bits. */
+static uint64_t get_trigram(const uint32_t *chars) {
+  return (uint64_t)chars[0] << 42 | (uint64_t)chars[1] << 21 | chars[2];
+}
+
+/* Get the distinct trigrams of folded text in increasing order. Returns the
+ * number of trigrams, which are stored in search->keys, or -1 on error. */
+static long get_trigrams(SEARCH *search, const FOLDED *text) {
+  uint64_t *keys = NULL;
+  uint64_t key;
+  size_t i, j, count = 0;
+  if (text->length < 3) {
+    return 0;
+  }
+  if (search->keys_size < text->length) {
+    keys = (uint64_t *)realloc(search->keys, text->length * sizeof(uint64_t));
+    if (!keys) {
+      error("Could not allocate memory");
+      return -1;
+    }
+    search->keys = keys;
+    search->keys_size = text->length;
+  }
+  keys = search->keys;
+  /* Messages are short, so the trigrams are sorted by insertion. */
+  for (i = 0; i + 2 < text->length; i++) {
+    key = get_trigram(text->chars + i);
+    for (j = count; j > 0 && keys[j - 1] > key; j--) {
+    }
+    if (j > 0 && keys[j - 1] == key) {
+      continue;
+    }
+    memmove(keys + j + 1, keys + j, (count - j) * sizeof(uint64_t));
+    keys[j] = key;
+    count++;
+  }
+  return (long)count;
+}
+
+/* Get the bucket of a trigram, or of the first empty bucket after it. */
+static POSTINGS *get_bucket(POSTINGS *table, size_t buckets, uint64_t trigram) {
+  size_t i = (size_t)((trigram * 0x9e3779b97f4a7c15ULL) >> 32) & (buckets - 1);
+  while (table[i].trigram && table[i].trigram != trigram) {
+    i = (i + 1) & (buckets - 1);
+  }
+  return &table[i];
+}
+
+/* Double the number of buckets in the trigram table. Returns 0 on error. */
+static int grow_table(SEARCH *search) {
+  size_t buckets = search->buckets * 2;
+  POSTINGS *table = (POSTINGS *)calloc(buckets, sizeof(POSTINGS));
+  size_t i;
+  if (!table) {
+    error("Could not allocate memory");
+    return 0;
+  }
+  for (i = 0; i < search->buckets; i++) {
+    if (search->table[i].trigram) {
+      *get_bucket(table, buckets, search->table[i].trigram) = search->table[i];
+    }
+  }
+  free(search->table);
+  search->table = table;
+  search->buckets = buckets;
+  return 1;
+}
+
+/* Add a task to the index with a new identifier. Returns 0 on error. */
+static int add_to_index(SEARCH *search, TASK *task) {
+  POSTINGS *postings = NULL;
+  TASK **tasks = NULL;
+  uint32_t *ids = NULL;
+  uint32_t id = search->next_id;
+  long count, i;
+  if (id == UINT32_MAX) {
+    error("Too many changes to search index");
+    return 0;
+  }
+  if (id >= search->tasks_size) {
+    tasks = (TASK **)realloc(search->tasks,
+        search->tasks_size * 2 * sizeof(TASK *));
+    if (!tasks) {
+      error("Could not allocate memory");
+      return 0;
+    }
+    search->tasks = tasks;
+    search->tasks_size *= 2;
+  }
+  if (!fold_text(task->message, &search->text)
+      || (count = get_trigrams(search, &search->text)) < 0) {
+    return 0;
+  }
+  search->next_id++;
+  search->tasks[id] = task;
+  task->search_id = id;
+  for (i = 0; i < count; i++) {
+    if ((search->trigrams + 1) * 2 > search->buckets && !grow_table(search)) {
+      return 0;
+    }
+    postings = get_bucket(search->table, search->buckets, search->keys[i]);
+    if (!postings->trigram) {
+      postings->trigram = search->keys[i];
+      search->trigrams++;
+    }
+    if (postings->count == postings->size) {
+      ids = (uint32_t *)realloc(postings->ids, (postings->size ? postings->size
+            * 2 : 4) * sizeof(uint32_t));
+      if (!ids) {
+        error("Could not allocate memory");
+        return 0;
+      }
+      postings->ids = ids;
+      postings->size = postings->size ? postings->size * 2 : 4;
+    }
+    postings->ids[postings->count++] = id;
+  }
+  return 1;
+}
+
+/* Remove a task from the index. Its identifier is left in the lists of the
+ * trigrams, which are checked when searching. */
+static void remove_from_index(SEARCH *search, TASK *task) {
+  if (task->search_id && task->search_id < search->next_id
+      && search->tasks[task->search_id] == task) {
+    search->tasks[task->search_id] = NULL;
+    search->stale++;
+  }
+  task->search_id = 0;
+}
+
+/* Delete the index. It is built again when it is next needed. */
+static void drop_index(SEARCH *search) {
+  size_t i;
+  if (search->table) {
+    for (i = 0; i < search->buckets; i++) {
+      free(search->table[i].ids);
+    }
+  }
+  free(search->table);
+  free(search->tasks);
+  search->table = NULL;
+  search->tasks = NULL;
+  search->built = 0;
+}
+
+/* Build the index of all tasks in a list. Returns 0 on error. */
+static int build_index(SEARCH *search, TODOLIST *list) {
+  TASK *task = NULL;
+  search->buckets = SEARCH_BUCKETS;
+  search->trigrams = 0;
+  search->tasks_size = list->task_count + 16;
+  search->next_id = 1;
+  search->stale = 0;
+  search->table = (POSTINGS *)calloc(search->buckets, sizeof(POSTINGS));
+  search->tasks = (TASK **)malloc(search->tasks_size * sizeof(TASK *));
+  search->built = 1;
+  if (!search->table || !search->tasks) {
+    error("Could not allocate memory");
+    drop_index(search);
+    return 0;
+  }
+  for (task = list->first; task; task = task->next) {
+    if (!add_to_index(search, task)) {
+      drop_index(search);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void update_index(TODOLIST *list, CHANGE *change, void *data) {
+  SEARCH *search = (SEARCH *)data;
+  (void)list;
+  if (!search->built) {
+    return;
+  }
+  switch (change->type) {
+    case CHANGE_DELETE:
+      remove_from_index(search, change->task);
+      break;
+    case CHANGE_MESSAGE:
+      remove_from_index(search, change->task);
+      /* fall through */
+    case CHANGE_INSERT:
+      if (!add_to_index(search, change->task)) {
+        drop_index(search);
+      }
+      break;
+  }
+}
+
+/* Whether the identifiers of a trigram contain an identifier. Identifiers are
+ * looked up in increasing order, so the search starts at *cursor, which is
+ * advanced past the smaller identifiers. */
+static int has_id(POSTINGS *postings, size_t *cursor, uint32_t id) {
+  uint32_t *ids = postings->ids;
+  size_t count = postings->count;
+  size_t low = *cursor;
+  size_t step = 1;
+  size_t high, middle;
+  /* Find a range containing the identifier by doubling steps, and then
+   * search it by halving it. */
+  while (low + step < count && ids[low + step] < id) {
+    low += step;
+    step *= 2;
+  }
+  high = low + step < count ? low + step + 1 : count;
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    if (ids[middle] < id) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  *cursor = low;
+  return low < count && ids[low] == id;
+}
+
+/* Get the distance from a position to another in a direction, wrapping around
+ * at the end of a list of count tasks. The distance from a position to itself
+ * is count. */
+static size_t get_distance(size_t from, size_t to, size_t count, int forward) {
+  size_t distance = forward ? (to + count - from) % count
+    : (from + count - to) % count;
+  return distance ? distance : count;
+}
+
+/* Find a match by checking every task, starting next to a position. */
+static TASK *scan_matches(SEARCH *search, TODOLIST *list, int order,
+    const FOLDED *query, size_t start, int forward) {
+  size_t count = list->task_count;
+  size_t i;
+  TASK *task = get_ordered_task(list, order, start);
+  for (i = 1; i <= count; i++) {
+    if (forward) {
+      task = get_next_ordered(list, order, task);
+      if (!task) {
+        task = get_ordered_task(list, order, 0);
+      }
+    }
+    else if (order == ORDER_LIST) {
+      task = task->prev ? task->prev : list->last;
+    }
+    else {
+      task = get_ordered_task(list, order, (start + count - i) % count);
+    }
+    if (!fold_text(task->message, &search->text)) {
+      return NULL;
+    }
+    if (contains(&search->text, query)) {
+      return task;
+    }
+  }
+  return NULL;
+}
+
+/* Find a match using the index. */
+static TASK *lookup_matches(SEARCH *search, TODOLIST *list, int order,
+    const FOLDED *query, size_t start, int forward) {
+  POSTINGS **postings = NULL;
+  POSTINGS *swap = NULL;
+  size_t *cursors = NULL;
+  TASK *task = NULL;
+  TASK *found = NULL;
+  size_t distance, best = 0;
+  long count, i, j;
+  uint32_t id;
+  /* The index is rebuilt once most identifiers are stale. */
+  if (search->built && search->stale * 2 > search->next_id) {
+    drop_index(search);
+  }
+  if ((!search->built && !build_index(search, list))
+      || (count = get_trigrams(search, query)) < 0) {
+    return NULL;
+  }
+  postings = (POSTINGS **)malloc(count * sizeof(POSTINGS *));
+  cursors = (size_t *)calloc(count, sizeof(size_t));
+  if (!postings || !cursors) {
+    error("Could not allocate memory");
+    free(postings);
+    free(cursors);
+    return NULL;
+  }
+  for (i = 0; i < count; i++) {
+    postings[i] = get_bucket(search->table, search->buckets, search->keys[i]);
+    if (!postings[i]->trigram) {
+      count = 0;
+      break;
+    }
+    /* The shortest list is first. */
+    for (j = i; j > 0 && postings[j - 1]->count > postings[j]->count; j--) {
+      swap = postings[j - 1];
+      postings[j - 1] = postings[j];
+      postings[j] = swap;
+    }
+  }
+  if (count && postings[0]->count > list->task_count / SEARCH_SCAN_RATIO) {
+    free(postings);
+    free(cursors);
+    return scan_matches(search, list, order, query, start, forward);
+  }
+  for (i = 0; count && i < postings[0]->count; i++) {
+    id = postings[0]->ids[i];
+    for (j = 1; j < count && has_id(postings[j], &cursors[j], id); j++) {
+    }
+    task = search->tasks[id];
+    if (j < count || !task) {
+      continue;
+    }
+    if (!fold_text(task->message, &search->text)) {
+      found = NULL;
+      break;
+    }
+    if (!contains(&search->text, query)) {
+      continue;
+    }
+    distance = get_distance(start, get_ordered_position(list, order, task),
+        list->task_count, forward);
+    if (!found || distance < best) {
+      found = task;
+      best = distance;
+    }
+  }
+  free(postings);
+  free(cursors);
+  return found;
+}
+
+SEARCH *open_search(TODOLIST *todolist) {
+  SEARCH *search = (SEARCH *)malloc(sizeof(SEARCH));
+  if (!search) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  search->built = 0;
+  search->table = NULL;
+  search->tasks = NULL;
+  search->text.chars = NULL;
+  search->text.length = 0;
+  search->text.size = 0;
+  search->keys = NULL;
+  search->keys_size = 0;
+  add_listener(todolist, update_index, search);
+  return search;
+}
+
+TASK *find_match(SEARCH *search, TODOLIST *todolist, int order,
+    const char *query, TASK *task, int forward) {
+  FOLDED folded = {NULL, 0, 0};
+  TASK *found = NULL;
+  size_t count = todolist->task_count;
+  size_t start;
+  if (!count || !fold_text(query, &folded)) {
+    free(folded.chars);
+    return NULL;
+  }
+  /* The search starts next to the task, which is found last. Without a task
+   * it starts next to the other end of the list. */
+  if (task) {
+    start = get_ordered_position(todolist, order, task);
+  }
+  else {
+    start = forward ? count - 1 : 0;
+  }
+  if (folded.length < 3) {
+    found = scan_matches(search, todolist, order, &folded, start, forward);
+  }
+  else {
+    found = lookup_matches(search, todolist, order, &folded, start, forward);
+  }
+  free(folded.chars);
+  return found;
+}
+
+int text_matches(const char *text, const char *query) {
+  QUERY *folded = new_query(query);
+  int matches = folded && query_matches(folded, text);
+  if (folded) {
+    delete_query(folded);
+  }
+  return matches;
+}
+
+QUERY *new_query(const char *query) {
+  QUERY *folded = (QUERY *)malloc(sizeof(QUERY));
+  if (!folded) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  folded->query.chars = NULL;
+  folded->query.length = 0;
+  folded->query.size = 0;
+  folded->text.chars = NULL;
+  folded->text.length = 0;
+  folded->text.size = 0;
+  if (!fold_text(query, &folded->query)) {
+    delete_query(folded);
+    return NULL;
+  }
+  return folded;
+}
+
+int query_matches(QUERY *query, const char *text) {
+  return fold_text(text, &query->text) && contains(&query->text, &query->query);
+}
+
+void delete_query(QUERY *query) {
+  free(query->query.chars);
+  free(query->text.chars);
+  free(query);
+}
+
+void close_search(SEARCH *search, TODOLIST *todolist) {
+  remove_listener(todolist, update_index, search);
+  drop_index(search);
+  free(search->text.chars);
+  free(search->keys);
+  free(search);
+}
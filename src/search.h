@@ -0,0 +1,49 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Case-insensitive search of task messages. Messages are decoded as UTF-8 and
+ * converted to lower case, and the tasks containing each trigram (sequence of
+ * three characters) are stored in an index. A query is answered by
+ * intersecting the lists of tasks containing its trigrams and checking the
+ * remaining tasks, so only queries shorter than three characters have to check
+ * every task.
+ *
+ * The index is built the first time it is needed, and is then updated when
+ * tasks are inserted, deleted or edited. */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "task.h"
+
+/* Search type */
+typedef struct SEARCH SEARCH;
+
+/* Query type, a query that has been converted to lower case once so it can be
+ * matched against many strings. */
+typedef struct QUERY QUERY;
+
+/* Start keeping track of changes to a list for searching it. */
+SEARCH *open_search(TODOLIST *todolist);
+/* Find the nearest task after (or before if forward is 0) a task in an order
+ * whose message contains a query. Wraps around at the end of the list, so task
+ * itself is found last. Starts at the first (or last) task if task is NULL.
+ * Returns NULL if no task matches. */
+TASK *find_match(SEARCH *search, TODOLIST *todolist, int order,
+    const char *query, TASK *task, int forward);
+/* Whether a string, e.g. the list title, contains a query. */
+int text_matches(const char *text, const char *query);
+/* Convert a query to lower case for matching it with query_matches(). Returns
+ * NULL on error. */
+QUERY *new_query(const char *query);
+/* Whether a string contains a query. Must not be called from more than one
+ * thread at a time for the same query. */
+int query_matches(QUERY *query, const char *text);
+/* Delete a query. */
+void delete_query(QUERY *query);
+/* Stop keeping track of changes to a list and delete the index. */
+void close_search(SEARCH *search, TODOLIST *todolist);
+
+#endif
@@ -0,0 +1,342 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "file.h"
+#include "writer.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+/* Identifies the snapshot format. */
+#define SNAPSHOT_MAGIC "ctodos03"
+/* Written in native byte order, so snapshots from machines with another byte
+ * order are rejected. */
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+/* Flag set on the message of a task that is done. */
+#define SNAPSHOT_DONE (1ULL << 63)
+/* The priority of a task is stored in the bits of its message below
+ * SNAPSHOT_DONE, and its depth in the eight bits below the priority. */
+#define SNAPSHOT_PRIORITY_SHIFT 56
+#define SNAPSHOT_DEPTH_SHIFT 48
+#define SNAPSHOT_OFFSET_MASK ((1ULL << SNAPSHOT_DEPTH_SHIFT) - 1)
+/* A file modified less than this many seconds before it was read may be
+ * modified again without changing its modification time. */
+#define SNAPSHOT_RACY_TIME 2
+
+/* The snapshot file starts with a header, followed by the task table, the
+ * option table, and the string pool. Strings are referred to by their offset
+ * in the pool. */
+typedef struct HEADER {
+  char magic[8]; /* SNAPSHOT_MAGIC. */
+  uint64_t byte_order; /* SNAPSHOT_BYTE_ORDER. */
+  SNAPSHOT_KEY key; /* Key of the list file. */
+  uint64_t title; /* List title. */
+  uint64_t tasks; /* Number of tasks. */
+  uint64_t options; /* Number of options. */
+  uint64_t pool_size; /* Size of string pool. */
+  uint64_t clean_end; /* See TODOLIST. */
+} HEADER;
+
+typedef struct ENTRY {
+  uint64_t message; /* Task message, with depth, priority and SNAPSHOT_DONE, or
+                       option key. */
+  uint64_t offset; /* Offset of task in the list file, or option value. */
+} ENTRY;
+
+/* Hash the content of a file. This is only used to detect changes, so it
+ * reads a word at a time rather than being a strong hash. */
+static uint64_t hash_content(const char *content, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL ^ length;
+  uint64_t word = 0;
+  size_t i;
+  for (i = 0; i + 8 <= length; i += 8) {
+    memcpy(&word, content + i, 8);
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+  }
+  word = 0;
+  if (i < length) {
+    memcpy(&word, content + i, length - i);
+  }
+  hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> 32);
+}
+
+void get_snapshot_key(SNAPSHOT_KEY *key, const struct stat *st,
+    const char *content, size_t length) {
+  key->size = length;
+  key->mtime = (uint64_t)st->st_mtime;
+  key->inode = (uint64_t)st->st_ino;
+  key->hash = hash_content(content, length);
+  key->read_time = (uint64_t)time(NULL);
+}
+
+#ifdef HAVE_MMAP
+/* Whether a file still matches the key it had when it was read. */
+static int key_matches(const SNAPSHOT_KEY *key, const char *filename) {
+  struct stat st;
+  STREAM *input = NULL;
+  int matches;
+  if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)
+      || (uint64_t)st.st_size != key->size
+      || (uint64_t)st.st_mtime != key->mtime
+      || (uint64_t)st.st_ino != key->inode) {
+    return 0;
+  }
+  if ((int64_t)key->mtime + SNAPSHOT_RACY_TIME <= (int64_t)key->read_time) {
+    return 1;
+  }
+  input = stream_mmap(filename);
+  if (!input) {
+    return 0;
+  }
+  matches = stream_get_size(input) == key->size
+    && hash_content(stream_get_content(input), key->size) == key->hash;
+  stream_close(input);
+  return matches;
+}
+
+/* Create a list from a mapped snapshot. Returns NULL if it is invalid. */
+static TODOLIST *read_snapshot(char *map, size_t size) {
+  HEADER *header = (HEADER *)map;
+  ENTRY *entries = (ENTRY *)(header + 1);
+  char *pool = NULL;
+  uint64_t i, message, priority, depth;
+  uint64_t next_offset = 0;
+  TODOLIST *list = NULL;
+  if (header->tasks > size / sizeof(ENTRY)
+      || header->options > size / sizeof(ENTRY)
+      || sizeof(HEADER) + (header->tasks + header->options) * sizeof(ENTRY)
+        + header->pool_size != size
+      || header->pool_size == 0 || header->title >= header->pool_size
+      || header->clean_end > header->key.size) {
+    return NULL;
+  }
+  pool = (char *)(entries + header->tasks + header->options);
+  /* All strings are terminated by the end of the pool at the latest. */
+  if (pool[header->pool_size - 1] != '\0') {
+    return NULL;
+  }
+  list = new_todolist(string_printf("%s", pool + header->title));
+  if (!list) {
+    return NULL;
+  }
+  list->image = map;
+  list->image_size = size;
+  list->image_mapped = 1;
+  for (i = 0; i < header->tasks; i++) {
+    message = entries[i].message & SNAPSHOT_OFFSET_MASK;
+    priority = (entries[i].message & ~SNAPSHOT_DONE) >> SNAPSHOT_PRIORITY_SHIFT;
+    depth = (entries[i].message >> SNAPSHOT_DEPTH_SHIFT) & 0xff;
+    /* The offsets of tasks increase within the file, except that tasks after
+     * the part that is written as it would be saved have none. */
+    if (message >= header->pool_size || priority > PRIORITY_MAX
+        || depth > DEPTH_MAX || (entries[i].offset != NO_OFFSET
+          && (entries[i].offset < next_offset
+            || entries[i].offset >= header->key.size))) {
+      delete_todolist(list);
+      return NULL;
+    }
+    next_offset = entries[i].offset == NO_OFFSET ? NO_OFFSET
+      : entries[i].offset + 1;
+    add_task(list, pool + message, (entries[i].message & SNAPSHOT_DONE) != 0,
+        (int)priority, (int)depth);
+    if (!list->last || list->last->message != pool + message) {
+      delete_todolist(list);
+      return NULL;
+    }
+    list->last->offset = entries[i].offset;
+  }
+  for (; i < header->tasks + header->options; i++) {
+    if (entries[i].message >= header->pool_size
+        || entries[i].offset >= header->pool_size) {
+      delete_todolist(list);
+      return NULL;
+    }
+    set_option(list, pool + entries[i].message, pool + entries[i].offset);
+  }
+  list->clean_end = header->clean_end;
+  list->file_size = header->key.size;
+  return list;
+}
+
+TODOLIST *load_snapshot(const char *filename) {
+  struct stat st;
+  HEADER *header = NULL;
+  TODOLIST *list = NULL;
+  void *map = MAP_FAILED;
+  char *name = string_printf("%s.ctodo-cache", filename);
+  int fd = name ? open(name, O_RDONLY) : -1;
+  free(name);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+      && (size_t)st.st_size >= sizeof(HEADER)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  header = (HEADER *)map;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, 8) == 0
+      && header->byte_order == SNAPSHOT_BYTE_ORDER
+      && key_matches(&header->key, filename)) {
+    list = read_snapshot((char *)map, st.st_size);
+  }
+  if (!list) {
+    munmap(map, st.st_size);
+  }
+  return list;
+}
+
+/* Whether a string is in the image of the file, which is at the start of the
+ * pool. */
+static int in_image(TODOLIST *todolist, const char *str) {
+  return todolist->image && !todolist->image_mapped && str >= todolist->image
+    && str < todolist->image + todolist->image_size;
+}
+
+/* Get the space needed for a string at the end of the pool. */
+static size_t string_space(TODOLIST *todolist, const char *str) {
+  return in_image(todolist, str) ? 0 : strlen(str) + 1;
+}
+
+/* Get the offset of a string in the pool, adding it to the end of the pool
+ * unless it is in the image. */
+static uint64_t add_string(char *pool, size_t *pool_size, TODOLIST *todolist,
+    const char *str) {
+  size_t length;
+  if (in_image(todolist, str)) {
+    return str - todolist->image;
+  }
+  length = strlen(str) + 1;
+  memcpy(pool + *pool_size, str, length);
+  *pool_size += length;
+  return *pool_size - length;
+}
+
+int save_snapshot_async(TODOLIST *todolist, const char *filename,
+    const SNAPSHOT_KEY *key) {
+  HEADER *header = NULL;
+  ENTRY *entry = NULL;
+  TASK *task = NULL;
+  OPTION *opt = NULL;
+  char *data = NULL;
+  char *pool = NULL;
+  char *name = NULL;
+  size_t tasks = 0;
+  size_t options = 0;
+  size_t image_size = todolist->image_mapped ? 0 : todolist->image_size;
+  size_t pool_size = image_size;
+  size_t length;
+  int status;
+  /* The size of the snapshot is computed first, so it can be written to a
+   * single buffer. Messages are loaded in place, so the image of the file is
+   * copied to the pool as a whole, and only strings that aren't in it are
+   * added separately. */
+  for (task = todolist->first; task; task = task->next, tasks++) {
+    pool_size += string_space(todolist, task->message);
+  }
+  for (opt = todolist->first_option; opt; opt = opt->next, options++) {
+    pool_size += string_space(todolist, opt->key)
+      + string_space(todolist, opt->value);
+  }
+  pool_size += string_space(todolist, todolist->title);
+  length = sizeof(HEADER) + (tasks + options) * sizeof(ENTRY) + pool_size;
+  data = (char *)malloc(length);
+  name = string_printf("%s.ctodo-cache", filename);
+  if (!data || !name) {
+    free(data);
+    free(name);
+    return 0;
+  }
+  header = (HEADER *)data;
+  entry = (ENTRY *)(header + 1);
+  pool = (char *)(entry + tasks + options);
+  memcpy(header->magic, SNAPSHOT_MAGIC, 8);
+  header->byte_order = SNAPSHOT_BYTE_ORDER;
+  header->key = *key;
+  header->tasks = tasks;
+  header->options = options;
+  header->pool_size = pool_size;
+  header->clean_end = todolist->clean_end;
+  pool_size = image_size;
+  if (pool_size) {
+    memcpy(pool, todolist->image, pool_size);
+    /* The byte after the content of the file may not have been written. */
+    pool[pool_size - 1] = '\0';
+  }
+  for (task = todolist->first; task; task = task->next, entry++) {
+    entry->message = add_string(pool, &pool_size, todolist, task->message)
+      | (uint64_t)task->priority << SNAPSHOT_PRIORITY_SHIFT
+      | (uint64_t)task->depth << SNAPSHOT_DEPTH_SHIFT;
+    if (task->done) {
+      entry->message |= SNAPSHOT_DONE;
+    }
+    entry->offset = task->offset;
+  }
+  for (opt = todolist->first_option; opt; opt = opt->next, entry++) {
+    entry->message = add_string(pool, &pool_size, todolist, opt->key);
+    entry->offset = add_string(pool, &pool_size, todolist, opt->value);
+  }
+  header->title = add_string(pool, &pool_size, todolist, todolist->title);
+  status = write_file_async(name, data, length, WRITE_CACHE);
+  free(name);
+  return status;
+}
+
+int update_snapshot(TODOLIST *todolist, const char *filename) {
+  struct stat st;
+  SNAPSHOT_KEY key;
+  STREAM *input = NULL;
+  int unchanged;
+  if (todolist->file_size == NO_OFFSET || todolist->file_size < SNAPSHOT_MIN_SIZE
+      || stat(filename, &st) != 0 || !file_unchanged(todolist, filename)) {
+    return 1;
+  }
+  input = stream_mmap(filename);
+  if (!input) {
+    return 1;
+  }
+  unchanged = stream_get_size(input) == todolist->file_size;
+  if (unchanged) {
+    get_snapshot_key(&key, &st, stream_get_content(input),
+        stream_get_size(input));
+  }
+  stream_close(input);
+  if (!unchanged) {
+    return 1;
+  }
+  return save_snapshot_async(todolist, filename, &key);
+}
+
+#else
+TODOLIST *load_snapshot(const char *filename) {
+  return NULL;
+}
+
+int save_snapshot_async(TODOLIST *todolist, const char *filename,
+    const SNAPSHOT_KEY *key) {
+  return 1;
+}
+
+int update_snapshot(TODOLIST *todolist, const char *filename) {
+  return 1;
+}
+#endif
@@ -0,0 +1,54 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Binary snapshots of large lists, which are stored next to the list file
+ * (e.g. "todo.txt.ctodo-cache") and can be mapped into memory instead of
+ * parsing the file when it hasn't changed.
+ *
+ * A snapshot contains a table of tasks, a table of options, and a pool of the
+ * null-terminated strings they refer to. It is keyed by the size, modification
+ * time, inode number and content hash of the file. Only the first three are
+ * compared when loading, unless the file was modified shortly before it was
+ * read, in which case a later change might not have changed its modification
+ * time, so the hash is compared as well. The list file is always the source of
+ * truth, and the snapshot can be deleted at any time. */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "task.h"
+
+/* Minimum size of a file for a snapshot to be written. Smaller files are
+ * parsed about as quickly as a snapshot is loaded. */
+#define SNAPSHOT_MIN_SIZE (1024 * 1024)
+
+/* Identifies the content of a list file. */
+typedef struct SNAPSHOT_KEY {
+  uint64_t size; /* Size of the file. */
+  uint64_t mtime; /* Modification time of the file. */
+  uint64_t inode; /* Inode number of the file. */
+  uint64_t hash; /* Hash of the content of the file. */
+  uint64_t read_time; /* Time at which the file was read. */
+} SNAPSHOT_KEY;
+
+/* Compute the key of a file that has just been read. st is the status of the
+ * file before it was read. */
+void get_snapshot_key(SNAPSHOT_KEY *key, const struct stat *st,
+    const char *content, size_t length);
+/* Load a list from the snapshot of a file. Returns NULL if there is no
+ * snapshot, or if it doesn't match the file. */
+TODOLIST *load_snapshot(const char *filename);
+/* Queue a snapshot of a list, which must have just been loaded from the file
+ * with the given key, to be written. Returns 0 on error. */
+int save_snapshot_async(TODOLIST *todolist, const char *filename,
+    const SNAPSHOT_KEY *key);
+/* Queue a snapshot of a list to be written if it is large and the file
+ * contains the list as it was last saved. Returns 0 on error. */
+int update_snapshot(TODOLIST *todolist, const char *filename);
+
+#endif
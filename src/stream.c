@@ -8,45 +8,129 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include "config.h"
 #include "stream.h"
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #define STREAM_TYPE_FILE 1
 #define STREAM_TYPE_BUFFER 2
+#define STREAM_TYPE_MMAP 3
+
+/* Initial capacity of buffers created with stream_new_buffer(). */
+#define STREAM_BUFFER_MIN 64
+/* Size of the blocks read from file streams by the cursor functions. */
+#define STREAM_BLOCK_SIZE 65536
 
 struct STREAM {
   int type;
   size_t length;
+  size_t capacity;
   size_t pos;
   void *obj;
+  /* Block buffer used by the cursor functions on file streams. Bytes in the
+   * block have already been read from the FILE. */
+  char *block;
+  size_t block_size;
+  size_t block_pos;
+  size_t block_length;
 };
 
+static STREAM *new_stream(int type, void *obj, size_t length) {
+  STREAM *stream = (STREAM *)malloc(sizeof(STREAM));
+  if (!stream) {
+    return NULL;
+  }
+  stream->type = type;
+  stream->obj = obj;
+  stream->length = length;
+  stream->capacity = length;
+  stream->pos = 0;
+  stream->block = NULL;
+  stream->block_size = 0;
+  stream->block_pos = 0;
+  stream->block_length = 0;
+  return stream;
+}
+
 STREAM *stream_file(const char *filename, const char *mode) {
   FILE *file = fopen(filename, mode);
-  STREAM *stream = NULL;
   if (!file) {
     return NULL;
   }
-  stream = (STREAM *)malloc(sizeof(STREAM));
-  stream->type = STREAM_TYPE_FILE;
-  stream->obj = file;
-  return stream;
+  return new_stream(STREAM_TYPE_FILE, file, 0);
 }
 
 STREAM *stream_buffer(char *buffer, size_t length) {
-  STREAM *stream = (STREAM *)malloc(sizeof(STREAM));
-  stream->type = STREAM_TYPE_BUFFER;
-  stream->obj = buffer;
-  stream->length = length;
-  stream->pos = 0;
+  return new_stream(STREAM_TYPE_BUFFER, buffer, length);
+}
+
+STREAM *stream_new_buffer(size_t capacity) {
+  STREAM *stream = NULL;
+  char *buffer = NULL;
+  if (capacity < STREAM_BUFFER_MIN) {
+    capacity = STREAM_BUFFER_MIN;
+  }
+  buffer = (char *)malloc(capacity);
+  if (!buffer) {
+    return NULL;
+  }
+  buffer[0] = '\0';
+  stream = stream_buffer(buffer, 0);
+  if (!stream) {
+    free(buffer);
+    return NULL;
+  }
+  stream->capacity = capacity;
   return stream;
 }
 
+STREAM *stream_mmap(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  FILE *file = NULL;
+#ifdef HAVE_MMAP
+  struct stat st;
+  void *map = NULL;
+#endif
+  if (fd < 0) {
+    return NULL;
+  }
+#ifdef HAVE_MMAP
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (st.st_size > 0) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+      close(fd);
+      if (map) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+      }
+      return new_stream(STREAM_TYPE_MMAP, map, map ? st.st_size : 0);
+    }
+  }
+#endif
+  /* Pipes, special files, and files that can't be mapped are read using
+   * stdio instead. */
+  file = fdopen(fd, "r");
+  if (!file) {
+    close(fd);
+    return NULL;
+  }
+  return new_stream(STREAM_TYPE_FILE, file, 0);
+}
+
 char *stream_get_content(STREAM *stream) {
   switch (stream->type) {
     case STREAM_TYPE_FILE:
       return NULL;
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
       return stream->obj;
     default:
       return NULL;
@@ -58,6 +142,7 @@ size_t stream_get_size(STREAM *stream) {
     case STREAM_TYPE_FILE:
       return 0;
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
       return stream->length;
     default:
       return 0;
@@ -71,30 +156,89 @@ void stream_close(STREAM *stream) {
       break;
     case STREAM_TYPE_BUFFER:
       break;
+    case STREAM_TYPE_MMAP:
+#ifdef HAVE_MMAP
+      if (stream->obj) {
+        munmap(stream->obj, stream->length);
+      }
+#endif
+      break;
   }
+  free(stream->block);
   free(stream);
 }
 
+char *stream_close_buffer(STREAM *stream, size_t *length) {
+  char *buffer = NULL;
+  if (stream->type == STREAM_TYPE_BUFFER) {
+    buffer = stream->obj;
+    if (length) {
+      *length = stream->length;
+    }
+  }
+  stream_close(stream);
+  return buffer;
+}
+
 char *resize_buffer(char *buffer, size_t oldsize, size_t newsize) {
-  char *new = NULL;
   if (newsize < oldsize) {
     return NULL;
   }
-  new = (char *)malloc(newsize);
-  if (!new) {
-    return NULL;
+  return (char *)realloc(buffer, newsize);
+}
+
+/* Make room for writing size bytes plus a terminating null byte at the
+ * current position of a buffer stream. The capacity is doubled as needed, so
+ * a sequence of writes runs in amortized linear time. */
+static int reserve_buffer(STREAM *output, size_t size) {
+  size_t capacity = output->capacity;
+  char *buffer = NULL;
+  if (output->pos + size < capacity) {
+    return 1;
+  }
+  if (capacity < STREAM_BUFFER_MIN) {
+    capacity = STREAM_BUFFER_MIN;
+  }
+  while (output->pos + size >= capacity) {
+    capacity *= 2;
+  }
+  buffer = resize_buffer(output->obj, output->capacity, capacity);
+  if (!buffer) {
+    return 0;
+  }
+  output->obj = buffer;
+  output->capacity = capacity;
+  return 1;
+}
+
+/* Update the length of a buffer stream after writing to it. */
+static void end_write(STREAM *output) {
+  if (output->pos > output->length) {
+    output->length = output->pos;
+    ((char *)output->obj)[output->length] = '\0';
   }
-  memcpy(new, buffer, oldsize);
-  free(buffer);
-  return new;
 }
 
 size_t stream_read(void *ptr, size_t size, size_t nmemb, STREAM *input) {
   size_t bytes, remaining;
   switch (input->type) {
     case STREAM_TYPE_FILE:
-      return fread(ptr, size, nmemb, input->obj);
+      bytes = size * nmemb;
+      remaining = input->block_length - input->block_pos;
+      if (remaining == 0) {
+        return fread(ptr, size, nmemb, input->obj);
+      }
+      if (remaining > bytes) {
+        remaining = bytes;
+      }
+      memcpy(ptr, input->block + input->block_pos, remaining);
+      input->block_pos += remaining;
+      if (remaining < bytes) {
+        remaining += fread((char *)ptr + remaining, 1, bytes - remaining, input->obj);
+      }
+      return remaining / size;
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
       bytes = size * nmemb;
       remaining = input->length - input->pos;
       if (remaining <= 0) {
@@ -120,38 +264,154 @@ size_t stream_read(void *ptr, size_t size, size_t nmemb, STREAM *input) {
 int stream_getc(STREAM *input) {
   switch (input->type) {
     case STREAM_TYPE_FILE:
+      if (input->block_pos < input->block_length) {
+        return (unsigned char)input->block[input->block_pos++];
+      }
+      input->block_pos = input->block_length = 0;
       return fgetc(input->obj);
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
       if (input->pos >= input->length) {
         return EOF;
       }
-      char *buffer = (char *)input->obj;
-      return buffer[input->pos++];
+      return ((unsigned char *)input->obj)[input->pos++];
     default:
       return EOF;
   }
 }
 
 void stream_ungetc(int c, STREAM *input) {
+  if (c == EOF) {
+    return;
+  }
+  switch (input->type) {
+    case STREAM_TYPE_FILE:
+      if (input->block_pos > 0) {
+        input->block_pos--;
+      }
+      else {
+        ungetc(c, input->obj);
+      }
+      break;
+    case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
+      /* The buffer is never written to, so only the last character read can
+       * be pushed back. */
+      if (input->pos > 0 && input->pos <= input->length) {
+        input->pos--;
+      }
+      break;
+  }
+}
+
+/* Get the unread part of the current block of an input stream. For file
+ * streams a new block is read when the current one has been consumed, and
+ * bytes are appended to the current block (which grows as needed) when
+ * extend is set. Returns the number of bytes available, 0 on EOF. */
+static size_t fill_block(STREAM *input, const char **data, int extend) {
+  size_t remaining, n;
+  char *block;
+  switch (input->type) {
+    case STREAM_TYPE_FILE:
+      remaining = input->block_length - input->block_pos;
+      if (remaining > 0 && !extend) {
+        break;
+      }
+      if (input->block_pos > 0) {
+        memmove(input->block, input->block + input->block_pos, remaining);
+        input->block_pos = 0;
+        input->block_length = remaining;
+      }
+      if (input->block_length >= input->block_size) {
+        n = input->block_size ? input->block_size * 2 : STREAM_BLOCK_SIZE;
+        block = (char *)realloc(input->block, n);
+        if (!block) {
+          break;
+        }
+        input->block = block;
+        input->block_size = n;
+      }
+      n = fread(input->block + input->block_length, 1,
+          input->block_size - input->block_length, input->obj);
+      input->block_length += n;
+      break;
+    case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
+      *data = (char *)input->obj + input->pos;
+      return input->pos < input->length ? input->length - input->pos : 0;
+    default:
+      return 0;
+  }
+  *data = input->block + input->block_pos;
+  return input->block_length - input->block_pos;
+}
+
+int stream_peek(STREAM *input) {
+  const char *data;
+  if (fill_block(input, &data, 0) == 0) {
+    return EOF;
+  }
+  return (unsigned char)*data;
+}
+
+void stream_advance(STREAM *input, size_t n) {
   switch (input->type) {
     case STREAM_TYPE_FILE:
-      ungetc(c, input->obj);
+      input->block_pos += n;
+      if (input->block_pos > input->block_length) {
+        input->block_pos = input->block_length;
+      }
       break;
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
+      input->pos += n;
       if (input->pos > input->length) {
         input->pos = input->length;
       }
-      char *buffer = (char *)input->obj;
-      buffer[--input->pos] = (char) c;
       break;
   }
 }
 
+const char *stream_span(STREAM *input, size_t *length) {
+  const char *data = NULL;
+  *length = fill_block(input, &data, 0);
+  return *length ? data : NULL;
+}
+
+const char *stream_line(STREAM *input, size_t *length) {
+  const char *data, *found;
+  size_t n, scanned = 0;
+  n = fill_block(input, &data, 0);
+  if (n == 0) {
+    return NULL;
+  }
+  while (1) {
+    found = memchr(data + scanned, '\n', n - scanned);
+    if (found) {
+      *length = found - data;
+      stream_advance(input, *length + 1);
+      return data;
+    }
+    scanned = n;
+    n = fill_block(input, &data, 1);
+    if (n == scanned) {
+      /* Last line of the stream is not terminated by a newline. */
+      *length = n;
+      stream_advance(input, n);
+      return data;
+    }
+  }
+}
+
 int stream_eof(STREAM *input) {
   switch (input->type) {
     case STREAM_TYPE_FILE:
+      if (input->block_pos < input->block_length) {
+        return 0;
+      }
       return feof((FILE *)input->obj);
     case STREAM_TYPE_BUFFER:
+    case STREAM_TYPE_MMAP:
       return input->pos >= input->length;
     default:
       return 1;
@@ -164,17 +424,38 @@ int stream_putc(int c, STREAM *output) {
     case STREAM_TYPE_FILE:
       return fputc(c, output->obj);
     case STREAM_TYPE_BUFFER:
-      if (output->pos >= output->length) {
-        output->obj = resize_buffer(output->obj, output->length, output->length + 100);
-        output->length += 100;
+      if (!reserve_buffer(output, 1)) {
+        return EOF;
       }
       ((char *)output->obj)[output->pos++] = ch;
+      end_write(output);
       return ch;
     default:
       return EOF;
   }
 }
 
+size_t stream_write(const void *ptr, size_t size, size_t nmemb, STREAM *output) {
+  size_t bytes = size * nmemb;
+  switch (output->type) {
+    case STREAM_TYPE_FILE:
+      return fwrite(ptr, size, nmemb, output->obj);
+    case STREAM_TYPE_BUFFER:
+      if (!bytes) {
+        return nmemb;
+      }
+      if (!reserve_buffer(output, bytes)) {
+        return 0;
+      }
+      memcpy((char *)output->obj + output->pos, ptr, bytes);
+      output->pos += bytes;
+      end_write(output);
+      return nmemb;
+    default:
+      return 0;
+  }
+}
+
 int stream_vprintf(STREAM *output, const char *format, va_list va) {
   int status = 0, n;
   va_list va2;
@@ -186,26 +467,27 @@ int stream_vprintf(STREAM *output, const char *format, va_list va) {
       va_end(va2);
       break;
     case STREAM_TYPE_BUFFER:
-      size = output->length - output->pos;
-      if (size <= 0) {
-        output->obj = resize_buffer(output->obj, output->length, output->length + 100);
-        output->length += 100;
+      if (!reserve_buffer(output, 0)) {
+        return 0;
       }
       while (1) {
         char *dest = (char *)output->obj + output->pos;
+        size = output->capacity - output->pos;
         va_copy(va2, va);
         n = vsnprintf(dest, size, format, va2);
         va_end(va2);
         if (n < 0) {
           return 0;
         }
-        if (n < size) {
+        if ((size_t)n < size) {
           output->pos += n;
+          end_write(output);
+          status = n;
           break;
         }
-        size = n + 1;
-        output->obj = resize_buffer(output->obj, output->length, size + output->pos);
-        output->length = size + output->pos;
+        if (!reserve_buffer(output, n)) {
+          return 0;
+        }
       }
       break;
   }
@@ -222,16 +504,15 @@ int stream_printf(STREAM *output, const char *format, ...) {
 }
 
 char *string_vprintf(const char *format, va_list va) {
-  size_t size = 32;
-  char *buffer = (char *)malloc(size);
   va_list va2;
-  STREAM *stream = stream_buffer(buffer, size);
+  STREAM *stream = stream_new_buffer(32);
+  if (!stream) {
+    return NULL;
+  }
   va_copy(va2, va);
   stream_vprintf(stream, format, va2);
   va_end(va2);
-  buffer = stream_get_content(stream);
-  stream_close(stream);
-  return buffer;
+  return stream_close_buffer(stream, NULL);
 }
 
 char *string_printf(const char *format, ...) {
@@ -17,14 +17,27 @@ typedef struct STREAM STREAM;
 
 /* Open a file as a stream (see fopen()). */
 STREAM *stream_file(const char *filename, const char *mode);
-/* Open a buffer as a stream. */
+/* Open a file as a read-only memory-mapped stream, e.g. to hash a list file or
+ * to replay a journal without copying it. Pipes, special files, and files that
+ * can't be mapped are opened as regular file streams instead. */
+STREAM *stream_mmap(const char *filename);
+/* Open a buffer as a stream. Writing past the end of the buffer grows it
+ * with realloc(), so it must have been allocated with malloc() if the stream
+ * is written to. */
 STREAM *stream_buffer(char *buffer, size_t length);
-/* Get buffer content (only for buffer streams). */
+/* Create an empty, growable buffer stream with room for at least capacity
+ * bytes. The content is always null-terminated. */
+STREAM *stream_new_buffer(size_t capacity);
+/* Get buffer content (only for buffer and memory-mapped streams). */
 char *stream_get_content(STREAM *stream);
-/* Get buffer size (only for buffer streams). */
+/* Get buffer size (only for buffer and memory-mapped streams). */
 size_t stream_get_size(STREAM *stream);
 /* Close stream. */
 void stream_close(STREAM *stream);
+/* Close a buffer stream and hand over its null-terminated content, which must
+ * be freed by the caller. The length of the content is stored in length
+ * unless it is NULL. */
+char *stream_close_buffer(STREAM *stream, size_t *length);
 
 /* Read from a stream (see fread()). */
 size_t stream_read(void *ptr, size_t size, size_t nmemb, STREAM *stream);
@@ -34,6 +47,9 @@ int stream_getc(STREAM *input);
 void stream_ungetc(int c, STREAM *input);
 /* Check for EOF (see feof()). */
 int stream_eof(STREAM *input);
+
+/* Write to a stream (see fwrite()). */
+size_t stream_write(const void *ptr, size_t size, size_t nmemb, STREAM *output);
 /* Write a character (see fputc()). */
 int stream_putc(int c, STREAM *output);
 /* Print to stream (see vfprintf()) */
@@ -41,6 +57,24 @@ int stream_vprintf(STREAM *output, const char *format, va_list va);
 /* Print to stream (see fprintf()) */
 int stream_printf(STREAM *output, const char *format, ...);
 
+/* The following cursor functions read input in blocks (buffer and
+ * memory-mapped streams are read in place) and allow scanning without copying
+ * or calling stream_getc() per byte. Pointers returned by them are valid until
+ * the next call to a read function on the stream. */
+
+/* Get the next byte without consuming it. Returns EOF at the end of the
+ * stream. */
+int stream_peek(STREAM *input);
+/* Consume n bytes. Only bytes already made available by stream_peek() or
+ * stream_span() can be consumed. */
+void stream_advance(STREAM *input, size_t n);
+/* Get the buffered unread bytes of the stream without consuming them. Returns
+ * NULL at the end of the stream. */
+const char *stream_span(STREAM *input, size_t *length);
+/* Consume the next line and return its content without the terminating
+ * newline. Returns NULL at the end of the stream. */
+const char *stream_line(STREAM *input, size_t *length);
+
 /* Like vsprintf(), but automatically creates a large enough buffer. */
 char *string_vprintf(const char *format, va_list va);
 /* Like sprintf(), but automatically creates a large enough buffer. */
@@ -13,29 +13,15 @@
 #include "stream.h"
 #include "error.h"
 
-char *downloaded_file = NULL;
-size_t downloaded_file_size = 0;
-
-// TODO: implement stream_write and replace this
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-  size_t data_size = size * nmemb;
-  if (downloaded_file) {
-    downloaded_file = resize_buffer(downloaded_file, downloaded_file_size, downloaded_file_size + data_size);
-  }
-  else {
-    downloaded_file = (char *)malloc(data_size);
-    downloaded_file_size = 0;
-  }
-  if (!downloaded_file) {
-    return 0;
-  }
-  memcpy(downloaded_file + downloaded_file_size, ptr, data_size);
-  downloaded_file_size += data_size;
-  return data_size;
+  return stream_write(ptr, size, nmemb, (STREAM *)userdata) * size;
 }
 
 TODOLIST *pull_todolist(char *origin) {
   TODOLIST *list = NULL;
+  STREAM *download = NULL;
+  char *content = NULL;
+  size_t length = 0;
   CURL *curl;
   CURLcode res;
   long http_status = 0;
@@ -44,11 +30,20 @@ TODOLIST *pull_todolist(char *origin) {
 
   curl = curl_easy_init();
   if (curl) {
+    download = stream_new_buffer(4096);
+    if (!download) {
+      error("Could not allocate memory");
+      curl_easy_cleanup(curl);
+      curl_global_cleanup();
+      return NULL;
+    }
     curl_easy_setopt(curl, CURLOPT_URL, origin);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, download);
 
     res = curl_easy_perform(curl);
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+    content = stream_close_buffer(download, &length);
     if (res != CURLE_OK) {
       error("Error: %s", curl_easy_strerror(res));
     }
@@ -56,12 +51,9 @@ TODOLIST *pull_todolist(char *origin) {
       error("Server returned %d", http_status);
     }
     else {
-      list = parse_todolist(downloaded_file, downloaded_file_size);
-    }
-    if (downloaded_file) {
-      free(downloaded_file);
-      downloaded_file = NULL;
+      list = parse_todolist(content, length);
     }
+    free(content);
 
     curl_easy_cleanup(curl);
   }
@@ -7,9 +7,585 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "task.h"
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+/* Notify listeners of a change to a task at a known position. */
+static void notify_at(TODOLIST *list, int type, TASK *task, size_t position,
+    size_t old_position, const char *old_value) {
+  CHANGE change;
+  LISTENER *listener = list->listeners;
+  change.type = type;
+  change.task = task;
+  change.position = position;
+  change.old_position = old_position;
+  change.old_value = old_value;
+  while (listener) {
+    listener->notify(list, &change, listener->data);
+    listener = listener->next;
+  }
+}
+
+/* Notify listeners of a change to a task. The position of the task is only
+ * computed if there are listeners. */
+static void notify(TODOLIST *list, int type, TASK *task, size_t old_position, const char *old_value) {
+  if (list->listeners) {
+    notify_at(list, type, task, task ? get_task_position(list, task) : 0,
+        old_position, old_value);
+  }
+}
+
+/* Generate a random weight (xorshift). */
+static unsigned int next_weight(TODOLIST *list) {
+  unsigned int x = list->index_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  list->index_seed = x;
+  return x;
+}
+
+/* Number of tasks allocated at a time. */
+#define TASK_SLAB 128
+
+/* Whether a message must be freed by the list, i.e. it doesn't point into the
+ * image of the file the list was loaded from or into the arena. */
+static int owns_message(TODOLIST *list, char *message) {
+  if (list->image && message >= list->image
+      && message < list->image + list->image_size) {
+    return 0;
+  }
+  return !arena_contains(&list->arena, message);
+}
+
+static void free_message(TODOLIST *list, char *message) {
+  if (owns_message(list, message)) {
+    list->owned_messages--;
+    free(message);
+  }
+}
+
+/* Allocate a task, reusing a deleted one if possible. The weight of the task
+ * in the indexes is chosen here, since it is shared by all indexes. */
+static TASK *new_task(TODOLIST *list, char *message) {
+  TASK *task = list->free_tasks;
+  if (task) {
+    list->free_tasks = task->next;
+  }
+  else {
+    if (list->slab_next == list->slab_end) {
+      list->slab_next = (TASK *)arena_alloc(&list->arena,
+          TASK_SLAB * sizeof(TASK));
+      list->slab_end = list->slab_next ? list->slab_next + TASK_SLAB : NULL;
+      if (!list->slab_next) {
+        return NULL;
+      }
+    }
+    task = list->slab_next++;
+  }
+  task->message = message;
+  task->weight = next_weight(list);
+  task->search_id = 0;
+  task->hidden = 0;
+  task->collapsed = 0;
+  if (owns_message(list, message)) {
+    list->owned_messages++;
+  }
+  return task;
+}
+
+/* Get the number of tasks in a subtree of an index. */
+static size_t subtree_size(TASK *task, int order) {
+  return task ? task->node[order].size : 0;
+}
+
+/* Kinds of tasks that are counted in the indexes, so that they can be found
+ * in logarithmic time. */
+#define COUNT_OPEN 0 /* Tasks that aren't done. */
+#define COUNT_SHOWN 1 /* Tasks that aren't hidden. */
+
+/* Whether a task is of a kind. */
+static int is_counted(TASK *task, int kind) {
+  return kind == COUNT_OPEN ? !task->done : !task->hidden;
+}
+
+/* Get the number of tasks of a kind in a subtree of an index. */
+static size_t subtree_count(TASK *task, int order, int kind) {
+  if (!task) {
+    return 0;
+  }
+  return task->node[order].size - (kind == COUNT_OPEN
+      ? task->node[order].done_size : task->node[order].hidden_size);
+}
+
+/* Compute the smallest depth in the subtree of a task in the ORDER_LIST index
+ * from those of its children. */
+static void update_min_depth(TASK *task) {
+  INDEX_NODE *node = &task->node[ORDER_LIST];
+  task->min_depth = task->depth;
+  if (node->left && node->left->min_depth < task->min_depth) {
+    task->min_depth = node->left->min_depth;
+  }
+  if (node->right && node->right->min_depth < task->min_depth) {
+    task->min_depth = node->right->min_depth;
+  }
+}
+
+/* Compute the counts of a task in an index from those of its children. */
+static void update_subtree(TASK *task, int order) {
+  INDEX_NODE *node = &task->node[order];
+  if (order == ORDER_LIST) {
+    update_min_depth(task);
+  }
+  node->size = 1 + subtree_size(node->left, order)
+    + subtree_size(node->right, order);
+  node->done_size = (task->done != 0)
+    + (node->left ? node->left->node[order].done_size : 0)
+    + (node->right ? node->right->node[order].done_size : 0);
+  node->hidden_size = (task->hidden != 0)
+    + (node->left ? node->left->node[order].hidden_size : 0)
+    + (node->right ? node->right->node[order].hidden_size : 0);
+}
+
+/* Get the rank of a priority in ORDER_PRIORITY, in which tasks without a
+ * priority come last. */
+static int priority_rank(int priority) {
+  return priority ? priority : PRIORITY_MAX + 1;
+}
+
+/* Whether a task comes before another in an order. */
+static int comes_before(TODOLIST *list, int order, TASK *a, TASK *b) {
+  if (order == ORDER_PRIORITY
+      && priority_rank(a->priority) != priority_rank(b->priority)) {
+    return priority_rank(a->priority) < priority_rank(b->priority);
+  }
+  return get_task_position(list, a) < get_task_position(list, b);
+}
+
+/* Replace a child of a task in an index, or the root if parent is NULL. */
+static void replace_child(TODOLIST *list, int order, TASK *parent, TASK *old,
+    TASK *new) {
+  if (!parent) {
+    list->index_root[order] = new;
+  }
+  else if (parent->node[order].left == old) {
+    parent->node[order].left = new;
+  }
+  else {
+    parent->node[order].right = new;
+  }
+  if (new) {
+    new->node[order].parent = parent;
+  }
+}
+
+/* Rotate a task above its parent in an index. */
+static void rotate_up(TODOLIST *list, int order, TASK *task) {
+  INDEX_NODE *node = &task->node[order];
+  TASK *parent = node->parent;
+  INDEX_NODE *parent_node = &parent->node[order];
+  replace_child(list, order, parent_node->parent, parent, task);
+  if (parent_node->left == task) {
+    parent_node->left = node->right;
+    if (parent_node->left) {
+      parent_node->left->node[order].parent = parent;
+    }
+    node->right = parent;
+  }
+  else {
+    parent_node->right = node->left;
+    if (parent_node->right) {
+      parent_node->right->node[order].parent = parent;
+    }
+    node->left = parent;
+  }
+  parent_node->parent = task;
+  node->size = parent_node->size;
+  node->done_size = parent_node->done_size;
+  node->hidden_size = parent_node->hidden_size;
+  if (order == ORDER_LIST) {
+    task->min_depth = parent->min_depth;
+  }
+  update_subtree(parent, order);
+}
+
+/* Join two subtrees of an index, where the tasks in a come before those in b.
+ * Returns the root of the result. */
+static TASK *join_trees(int order, TASK *a, TASK *b) {
+  if (!a || !b) {
+    return a ? a : b;
+  }
+  if (a->weight >= b->weight) {
+    a->node[order].right = join_trees(order, a->node[order].right, b);
+    a->node[order].right->node[order].parent = a;
+    update_subtree(a, order);
+    return a;
+  }
+  b->node[order].left = join_trees(order, a, b->node[order].left);
+  b->node[order].left->node[order].parent = b;
+  update_subtree(b, order);
+  return b;
+}
+
+/* Split a subtree of an index into its first count tasks and the rest. The
+ * parents of the roots of the results are not set. */
+static void split_tree(int order, TASK *task, size_t count, TASK **a, TASK **b) {
+  INDEX_NODE *node = NULL;
+  size_t left;
+  if (!task) {
+    *a = NULL;
+    *b = NULL;
+    return;
+  }
+  node = &task->node[order];
+  left = subtree_size(node->left, order);
+  if (count <= left) {
+    split_tree(order, node->left, count, a, &node->left);
+    if (node->left) {
+      node->left->node[order].parent = task;
+    }
+    *b = task;
+  }
+  else {
+    split_tree(order, node->right, count - left - 1, &node->right, b);
+    if (node->right) {
+      node->right->node[order].parent = task;
+    }
+    *a = task;
+  }
+  update_subtree(task, order);
+}
+
+/* Set the root of an index. */
+static void set_root(TODOLIST *list, int order, TASK *root) {
+  if (root) {
+    root->node[order].parent = NULL;
+  }
+  list->index_root[order] = root;
+}
+
+/* Remove count tasks from a position in an index, and return the subtree
+ * containing them. Used for ORDER_LIST, in which they are consecutive. */
+static TASK *cut_tasks(TODOLIST *list, int order, size_t position,
+    size_t count) {
+  TASK *before = NULL;
+  TASK *tasks = NULL;
+  TASK *after = NULL;
+  if (!list->indexed[order]) {
+    return NULL;
+  }
+  split_tree(order, list->index_root[order], position, &before, &after);
+  split_tree(order, after, count, &tasks, &after);
+  set_root(list, order, join_trees(order, before, after));
+  return tasks;
+}
+
+/* Add a subtree returned by cut_tasks() at a position in an index. */
+static void paste_tasks(TODOLIST *list, int order, TASK *tasks,
+    size_t position) {
+  TASK *before = NULL;
+  TASK *after = NULL;
+  if (!list->indexed[order]) {
+    return;
+  }
+  split_tree(order, list->index_root[order], position, &before, &after);
+  set_root(list, order, join_trees(order, join_trees(order, before, tasks),
+        after));
+}
+
+/* Build an index in a single pass over the list. The tasks are added in order
+ * to the right spine of a treap, which is kept on a stack linked by parent
+ * pointers. For ORDER_PRIORITY there is a treap for each priority, and they
+ * are joined at the end. */
+static void build_index(TODOLIST *list, int order) {
+  TASK *spines[PRIORITY_MAX + 2];
+  TASK *task = NULL;
+  TASK *spine = NULL;
+  TASK *top = NULL;
+  TASK *root = NULL;
+  int rank = 0;
+  memset(spines, 0, sizeof(spines));
+  for (task = list->first; task; task = task->next) {
+    if (order == ORDER_PRIORITY) {
+      rank = priority_rank(task->priority);
+    }
+    spine = spines[rank];
+    task->node[order].right = NULL;
+    top = NULL;
+    while (spine && spine->weight < task->weight) {
+      update_subtree(spine, order);
+      top = spine;
+      spine = spine->node[order].parent;
+    }
+    task->node[order].left = top;
+    if (top) {
+      top->node[order].parent = task;
+    }
+    task->node[order].parent = spine;
+    if (spine) {
+      spine->node[order].right = task;
+    }
+    spines[rank] = task;
+  }
+  for (rank = 0; rank < PRIORITY_MAX + 2; rank++) {
+    top = NULL;
+    for (spine = spines[rank]; spine; spine = spine->node[order].parent) {
+      update_subtree(spine, order);
+      top = spine;
+    }
+    root = join_trees(order, root, top);
+  }
+  if (root) {
+    root->node[order].parent = NULL;
+  }
+  list->index_root[order] = root;
+  list->indexed[order] = 1;
+}
+
+/* Build an index unless it is up to date. */
+static void need_index(TODOLIST *list, int order) {
+  if (!list->indexed[order]) {
+    build_index(list, order);
+  }
+}
+
+/* Add a task that has been linked into the list to an index. The task must
+ * already be in the ORDER_LIST index when it is added to others. */
+static void index_insert(TODOLIST *list, int order, TASK *task) {
+  INDEX_NODE *node = &task->node[order];
+  TASK *parent = NULL;
+  TASK *child = NULL;
+  int left = 0;
+  if (!list->indexed[order]) {
+    return;
+  }
+  node->left = NULL;
+  node->right = NULL;
+  node->size = 1;
+  node->done_size = task->done != 0;
+  node->hidden_size = task->hidden != 0;
+  if (order == ORDER_LIST) {
+    task->min_depth = task->depth;
+    /* The task is the left child of the next task, or else the right child
+     * of the previous task. */
+    parent = task->next && !task->next->node[order].left ? task->next
+      : task->prev;
+    left = parent && parent == task->next;
+  }
+  else {
+    for (child = list->index_root[order]; child; ) {
+      parent = child;
+      left = comes_before(list, order, task, child);
+      child = left ? child->node[order].left : child->node[order].right;
+    }
+  }
+  if (!parent) {
+    list->index_root[order] = task;
+  }
+  else if (left) {
+    parent->node[order].left = task;
+  }
+  else {
+    parent->node[order].right = task;
+  }
+  node->parent = parent;
+  for (; parent; parent = parent->node[order].parent) {
+    parent->node[order].size++;
+    parent->node[order].done_size += node->done_size;
+    parent->node[order].hidden_size += node->hidden_size;
+    if (order == ORDER_LIST && task->depth < parent->min_depth) {
+      parent->min_depth = task->depth;
+    }
+  }
+  while (node->parent && node->parent->weight < task->weight) {
+    rotate_up(list, order, task);
+  }
+}
+
+/* Remove a task from an index. */
+static void index_remove(TODOLIST *list, int order, TASK *task) {
+  INDEX_NODE *node = &task->node[order];
+  TASK *child = NULL;
+  if (!list->indexed[order]) {
+    return;
+  }
+  while (node->left || node->right) {
+    child = node->left;
+    if (!child || (node->right && node->right->weight > child->weight)) {
+      child = node->right;
+    }
+    rotate_up(list, order, child);
+  }
+  replace_child(list, order, node->parent, task, NULL);
+  for (child = node->parent; child; child = child->node[order].parent) {
+    child->node[order].size--;
+    child->node[order].done_size -= task->done != 0;
+    child->node[order].hidden_size -= task->hidden != 0;
+    if (order == ORDER_LIST) {
+      update_min_depth(child);
+    }
+  }
+}
+
+/* Add a task that has been linked into the list to all indexes. */
+static void index_insert_all(TODOLIST *list, TASK *task) {
+  int order;
+  for (order = 0; order < ORDER_COUNT; order++) {
+    index_insert(list, order, task);
+  }
+}
+
+/* Remove a task from all indexes. */
+static void index_remove_all(TODOLIST *list, TASK *task) {
+  int order;
+  for (order = 0; order < ORDER_COUNT; order++) {
+    index_remove(list, order, task);
+  }
+}
+
+/* Number of keys by which tasks are sorted in an order before their position
+ * in the list (see order_key()). */
+#define ORDER_KEYS (PRIORITY_MAX + 2)
+
+/* Get the key of a task in an order. */
+static int order_key(int order, TASK *task) {
+  return order == ORDER_PRIORITY ? priority_rank(task->priority) : 0;
+}
+
+/* Consecutive tasks in the list that have been cut out of the index of an
+ * order. Those with the same key are also consecutive in the index, so they
+ * are cut out as a run for each key. */
+typedef struct RUNS {
+  TASK *first[ORDER_KEYS]; /* First task of each run, or NULL. */
+  TASK *rest[ORDER_KEYS]; /* Subtree of the other tasks of each run. */
+} RUNS;
+
+/* Cut the tasks from first to end (exclusive) out of the index of an order
+ * other than ORDER_LIST. */
+static void cut_runs(TODOLIST *list, int order, TASK *first, TASK *end,
+    RUNS *runs) {
+  size_t counts[ORDER_KEYS];
+  TASK *task = NULL;
+  int key;
+  memset(counts, 0, sizeof(counts));
+  memset(runs, 0, sizeof(RUNS));
+  if (!list->indexed[order]) {
+    return;
+  }
+  for (task = first; task != end; task = task->next) {
+    key = order_key(order, task);
+    if (!counts[key]++) {
+      runs->first[key] = task;
+    }
+  }
+  for (key = 0; key < ORDER_KEYS; key++) {
+    if (runs->first[key]) {
+      runs->rest[key] = cut_tasks(list, order,
+          get_ordered_position(list, order, runs->first[key]) + 1,
+          counts[key] - 1);
+      index_remove(list, order, runs->first[key]);
+    }
+  }
+}
+
+/* Add tasks cut out by cut_runs() back to an index when they have been linked
+ * into the list again. The first task of each run is inserted on its own, and
+ * the rest of the run after it. */
+static void paste_runs(TODOLIST *list, int order, RUNS *runs) {
+  int key;
+  for (key = 0; key < ORDER_KEYS; key++) {
+    if (runs->first[key]) {
+      index_insert(list, order, runs->first[key]);
+      paste_tasks(list, order, runs->rest[key],
+          get_ordered_position(list, order, runs->first[key]) + 1);
+    }
+  }
+}
+
+/* Mark the list as changed from the offset of a task. */
+static void mark_dirty(TODOLIST *list, TASK *task) {
+  if (task && task->offset < list->dirty_offset) {
+    list->dirty_offset = task->offset;
+  }
+}
+
+/* Free a task that has been removed from the list and the indexes. */
+static void release_task(TODOLIST *list, TASK *task) {
+  list->task_count--;
+  list->done_count -= task->done != 0;
+  if (task->hidden) {
+    list->hidden_count--;
+    list->hidden_done_count -= task->done != 0;
+  }
+  free_message(list, task->message);
+  task->next = list->free_tasks;
+  list->free_tasks = task;
+}
+
+/* Number of tasks changed at once relative to the size of the list above which
+ * the indexes are rebuilt when next needed instead of being updated a task at
+ * a time. */
+#define INDEX_REBUILD_RATIO 8
+
+/* Prepare the indexes for a change to count tasks at once. Returns 1 if they
+ * have been marked as out of date, in which case they need not be updated. */
+static int skip_indexes(TODOLIST *list, size_t count) {
+  int order;
+  if (count * INDEX_REBUILD_RATIO <= list->task_count) {
+    return 0;
+  }
+  for (order = 0; order < ORDER_COUNT; order++) {
+    list->indexed[order] = 0;
+  }
+  return 1;
+}
+
+TODOLIST *new_todolist(char *title) {
+  int i;
+  TODOLIST *list = (TODOLIST *)malloc(sizeof(TODOLIST));
+  if (!list) {
+    return NULL;
+  }
+  list->title = title;
+  list->first = NULL;
+  list->last = NULL;
+  list->first_option = NULL;
+  list->last_option = NULL;
+  list->option_table = NULL;
+  list->option_buckets = 0;
+  list->option_count = 0;
+  list->listeners = NULL;
+  list->dirty_offset = NO_OFFSET;
+  list->clean_end = 0;
+  list->file_size = NO_OFFSET;
+  list->file_mtime = 0;
+  list->image = NULL;
+  list->image_size = 0;
+  list->image_mapped = 0;
+  init_arena(&list->arena);
+  list->free_tasks = NULL;
+  list->slab_next = NULL;
+  list->slab_end = NULL;
+  list->owned_messages = 0;
+  list->task_count = 0;
+  list->done_count = 0;
+  list->hidden_count = 0;
+  list->hidden_done_count = 0;
+  for (i = 0; i < ORDER_COUNT; i++) {
+    list->index_root[i] = NULL;
+    list->indexed[i] = 0;
+  }
+  list->index_seed = 2463534242u;
+  return list;
+}
+
 void delete_task(TASK *delete, TODOLIST *list) {
+  notify(list, CHANGE_DELETE, delete, 0, NULL);
+  mark_dirty(list, delete);
   if (delete->prev) {
     delete->prev->next = delete->next;
   }
@@ -22,18 +598,25 @@ void delete_task(TASK *delete, TODOLIST *list) {
   else {
     list->last = delete->prev;
   }
-  free(delete->message);
-  free(delete);
+  index_remove_all(list, delete);
+  release_task(list, delete);
+}
+
+/* Limit a depth to the range from 0 to DEPTH_MAX. */
+static int clamp_depth(int depth) {
+  return depth < 0 ? 0 : depth > DEPTH_MAX ? DEPTH_MAX : depth;
 }
 
-void add_task(TODOLIST *list, char *message, int done, int priority) {
-  TASK *task = (TASK *)malloc(sizeof(TASK));
+void add_task(TODOLIST *list, char *message, int done, int priority,
+    int depth) {
+  TASK *task = new_task(list, message);
   if (!task) {
     return;
   }
-  task->message = message;
   task->done = done;
   task->priority = priority;
+  task->depth = clamp_depth(depth);
+  task->offset = NO_OFFSET;
   task->next = NULL;
   task->prev = list->last;
   if (!list->first) {
@@ -43,18 +626,25 @@ void add_task(TODOLIST *list, char *message, int done, int priority) {
     list->last->next = task;
   }
   list->last = task;
+  list->task_count++;
+  list->done_count += done != 0;
+  index_insert_all(list, task);
+  notify(list, CHANGE_INSERT, task, 0, NULL);
 }
 
-void insert_task(TODOLIST *list, TASK *next, char *message, int done, int priority) {
-  TASK *task = (TASK *)malloc(sizeof(TASK));
+void insert_task(TODOLIST *list, TASK *next, char *message, int done,
+    int priority, int depth) {
+  TASK *task = new_task(list, message);
   if (!task) {
     return;
   }
-  task->message = message;
   task->done = done;
   task->priority = priority;
+  task->depth = clamp_depth(depth);
+  task->offset = NO_OFFSET;
   task->next = next;
   task->prev = next->prev;
+  mark_dirty(list, next);
   if (list->first == next) {
     list->first = task;
   }
@@ -62,11 +652,17 @@ void insert_task(TODOLIST *list, TASK *next, char *message, int done, int priori
     next->prev->next = task;
   }
   next->prev = task;
+  list->task_count++;
+  list->done_count += done != 0;
+  index_insert_all(list, task);
+  notify(list, CHANGE_INSERT, task, 0, NULL);
 }
 
 void move_task_up(TODOLIST *list, TASK *task) {
   if (task->prev) {
     TASK *prev = task->prev;
+    size_t position = list->listeners ? get_task_position(list, task) : 0;
+    mark_dirty(list, prev);
     task->prev = prev->prev;
     if (task->prev) {
       task->prev->next = task;
@@ -83,12 +679,17 @@ void move_task_up(TODOLIST *list, TASK *task) {
       list->last = prev;
     }
     task->next = prev;
+    index_remove_all(list, task);
+    index_insert_all(list, task);
+    notify(list, CHANGE_MOVE, task, position, NULL);
   }
 }
 
 void move_task_down(TODOLIST *list, TASK *task) {
   if (task->next) {
     TASK *next = task->next;
+    size_t position = list->listeners ? get_task_position(list, task) : 0;
+    mark_dirty(list, task);
     task->next = next->next;
     if (task->next) {
       task->next->prev = task;
@@ -105,28 +706,701 @@ void move_task_down(TODOLIST *list, TASK *task) {
       list->first = next;
     }
     task->prev = next;
+    index_remove_all(list, task);
+    index_insert_all(list, task);
+    notify(list, CHANGE_MOVE, task, position, NULL);
   }
 }
 
-char *get_option(TODOLIST *todolist, const char *key) {
-  OPTION *opt = todolist->first_option;
-  while (opt) {
+void move_task(TODOLIST *list, TASK *task, TASK *next) {
+  size_t position;
+  if (task == next || task->next == next) {
+    return;
+  }
+  position = list->listeners ? get_task_position(list, task) : 0;
+  mark_dirty(list, task);
+  mark_dirty(list, next);
+  if (task->prev) {
+    task->prev->next = task->next;
+  }
+  else {
+    list->first = task->next;
+  }
+  if (task->next) {
+    task->next->prev = task->prev;
+  }
+  else {
+    list->last = task->prev;
+  }
+  task->next = next;
+  if (next) {
+    task->prev = next->prev;
+    next->prev = task;
+  }
+  else {
+    task->prev = list->last;
+    list->last = task;
+  }
+  if (task->prev) {
+    task->prev->next = task;
+  }
+  else {
+    list->first = task;
+  }
+  index_remove_all(list, task);
+  index_insert_all(list, task);
+  notify(list, CHANGE_MOVE, task, position, NULL);
+}
+
+/* Count the tasks from first to last. */
+static size_t count_tasks(TASK *first, TASK *last) {
+  size_t count = 1;
+  for (; first != last; first = first->next) {
+    count++;
+  }
+  return count;
+}
+
+void delete_tasks(TODOLIST *list, TASK *first, TASK *last) {
+  TASK *end = last->next;
+  TASK *task = NULL;
+  TASK *next = NULL;
+  size_t count = count_tasks(first, last);
+  size_t position = 0;
+  RUNS runs;
+  int order;
+  if (list->listeners || list->indexed[ORDER_LIST]) {
+    position = get_task_position(list, first);
+  }
+  /* Each deleted task is reported at the position of the first one, as if
+   * they were deleted one at a time. */
+  for (task = first; task != end; task = task->next) {
+    notify_at(list, CHANGE_DELETE, task, position, 0, NULL);
+  }
+  mark_dirty(list, first);
+  /* The tasks are removed from the indexes a subtree at a time. */
+  cut_tasks(list, ORDER_LIST, position, count);
+  for (order = ORDER_LIST + 1; order < ORDER_COUNT; order++) {
+    cut_runs(list, order, first, end, &runs);
+  }
+  if (first->prev) {
+    first->prev->next = end;
+  }
+  else {
+    list->first = end;
+  }
+  if (end) {
+    end->prev = first->prev;
+  }
+  else {
+    list->last = first->prev;
+  }
+  for (task = first; task != end; task = next) {
+    next = task->next;
+    release_task(list, task);
+  }
+}
+
+size_t delete_done_tasks(TODOLIST *list) {
+  TASK *task = NULL;
+  TASK *next = NULL;
+  size_t count = list->done_count;
+  size_t position = 0;
+  if (!count) {
+    return 0;
+  }
+  /* A listener may rebuild the indexes, so tasks are still removed from
+   * them. */
+  skip_indexes(list, count);
+  for (task = list->first; task; task = next) {
+    next = task->next;
+    if (!task->done) {
+      position++;
+      continue;
+    }
+    notify_at(list, CHANGE_DELETE, task, position, 0, NULL);
+    mark_dirty(list, task);
+    index_remove_all(list, task);
+    if (task->prev) {
+      task->prev->next = next;
+    }
+    else {
+      list->first = next;
+    }
+    if (next) {
+      next->prev = task->prev;
+    }
+    else {
+      list->last = task->prev;
+    }
+    release_task(list, task);
+  }
+  return count;
+}
+
+void move_tasks(TODOLIST *list, TASK *first, TASK *last, TASK *next) {
+  TASK *end = last->next;
+  TASK *task = NULL;
+  TASK *tasks = NULL;
+  RUNS runs[ORDER_COUNT];
+  size_t count, i;
+  size_t old_position = 0;
+  size_t position = 0;
+  int order;
+  if (next == first || next == end) {
+    return;
+  }
+  count = count_tasks(first, last);
+  if (list->listeners || list->indexed[ORDER_LIST]) {
+    old_position = get_task_position(list, first);
+    position = get_task_position(list, next);
+    if (position > old_position) {
+      position -= count;
+    }
+  }
+  mark_dirty(list, first);
+  mark_dirty(list, next);
+  /* The tasks are moved in the indexes a subtree at a time. */
+  tasks = cut_tasks(list, ORDER_LIST, old_position, count);
+  for (order = ORDER_LIST + 1; order < ORDER_COUNT; order++) {
+    cut_runs(list, order, first, end, &runs[order]);
+  }
+  if (first->prev) {
+    first->prev->next = end;
+  }
+  else {
+    list->first = end;
+  }
+  if (end) {
+    end->prev = first->prev;
+  }
+  else {
+    list->last = first->prev;
+  }
+  first->prev = next ? next->prev : list->last;
+  last->next = next;
+  if (first->prev) {
+    first->prev->next = first;
+  }
+  else {
+    list->first = first;
+  }
+  if (next) {
+    next->prev = last;
+  }
+  else {
+    list->last = last;
+  }
+  paste_tasks(list, ORDER_LIST, tasks, position);
+  for (order = ORDER_LIST + 1; order < ORDER_COUNT; order++) {
+    paste_runs(list, order, &runs[order]);
+  }
+  if (!list->listeners) {
+    return;
+  }
+  /* The moves are reported as if the tasks were moved one at a time, so that
+   * each reported move is valid when the previous ones have been made. Tasks
+   * moved up are reported first to last, and tasks moved down last to
+   * first. */
+  if (position < old_position) {
+    for (task = first, i = 0; i < count; task = task->next, i++) {
+      notify_at(list, CHANGE_MOVE, task, position + i, old_position + i, NULL);
+    }
+  }
+  else {
+    for (task = last, i = count; i > 0; task = task->prev, i--) {
+      notify_at(list, CHANGE_MOVE, task, position + i - 1, old_position + i - 1,
+          NULL);
+    }
+  }
+}
+
+void set_task_done(TODOLIST *list, TASK *task, int done) {
+  TASK *parent = NULL;
+  int order;
+  if (task->done == done) {
+    return;
+  }
+  if ((task->done != 0) != (done != 0)) {
+    list->done_count += done ? 1 : -1;
+    if (task->hidden) {
+      list->hidden_done_count += done ? 1 : -1;
+    }
+    for (order = 0; order < ORDER_COUNT; order++) {
+      if (!list->indexed[order]) {
+        continue;
+      }
+      for (parent = task; parent; parent = parent->node[order].parent) {
+        parent->node[order].done_size += done ? 1 : -1;
+      }
+    }
+  }
+  task->done = done;
+  mark_dirty(list, task);
+  notify(list, CHANGE_DONE, task, 0, NULL);
+}
+
+void set_task_priority(TODOLIST *list, TASK *task, int priority) {
+  int old = task->priority;
+  if (old == priority) {
+    return;
+  }
+  index_remove(list, ORDER_PRIORITY, task);
+  task->priority = priority;
+  index_insert(list, ORDER_PRIORITY, task);
+  mark_dirty(list, task);
+  notify(list, CHANGE_PRIORITY, task, old, NULL);
+}
+
+void set_task_depth(TODOLIST *list, TASK *task, int depth) {
+  TASK *parent = NULL;
+  int old = task->depth;
+  depth = clamp_depth(depth);
+  if (old == depth) {
+    return;
+  }
+  task->depth = depth;
+  if (list->indexed[ORDER_LIST]) {
+    for (parent = task; parent; parent = parent->node[ORDER_LIST].parent) {
+      update_min_depth(parent);
+    }
+  }
+  mark_dirty(list, task);
+  notify(list, CHANGE_DEPTH, task, old, NULL);
+}
+
+void set_task_message(TODOLIST *list, TASK *task, char *message) {
+  char *old = task->message;
+  task->message = message;
+  if (owns_message(list, message)) {
+    list->owned_messages++;
+  }
+  mark_dirty(list, task);
+  notify(list, CHANGE_MESSAGE, task, 0, old);
+  free_message(list, old);
+}
+
+void set_title(TODOLIST *list, char *title) {
+  char *old = list->title;
+  list->title = title;
+  list->dirty_offset = 0;
+  notify(list, CHANGE_TITLE, NULL, 0, old);
+  free(old);
+}
+
+void set_task_hidden(TODOLIST *list, TASK *task, int hidden) {
+  TASK *parent = NULL;
+  int order;
+  if ((task->hidden != 0) == (hidden != 0)) {
+    task->hidden = hidden;
+    return;
+  }
+  list->hidden_count += hidden ? 1 : -1;
+  if (task->done) {
+    list->hidden_done_count += hidden ? 1 : -1;
+  }
+  for (order = 0; order < ORDER_COUNT; order++) {
+    if (!list->indexed[order]) {
+      continue;
+    }
+    for (parent = task; parent; parent = parent->node[order].parent) {
+      parent->node[order].hidden_size += hidden ? 1 : -1;
+    }
+  }
+  task->hidden = hidden;
+}
+
+size_t get_task_position(TODOLIST *list, TASK *task) {
+  return get_ordered_position(list, ORDER_LIST, task);
+}
+
+TASK *get_task_at(TODOLIST *list, size_t position) {
+  return get_ordered_task(list, ORDER_LIST, position);
+}
+
+size_t get_ordered_position(TODOLIST *list, int order, TASK *task) {
+  size_t position;
+  if (!task) {
+    return list->task_count;
+  }
+  need_index(list, order);
+  position = subtree_size(task->node[order].left, order);
+  for (; task->node[order].parent; task = task->node[order].parent) {
+    if (task->node[order].parent->node[order].right == task) {
+      position += subtree_size(task->node[order].parent->node[order].left,
+          order) + 1;
+    }
+  }
+  return position;
+}
+
+TASK *get_ordered_task(TODOLIST *list, int order, size_t position) {
+  TASK *task = NULL;
+  size_t left;
+  if (position >= list->task_count) {
+    return NULL;
+  }
+  /* The ends of the list don't require the index, e.g. while a list is being
+   * loaded. */
+  if (order == ORDER_LIST && position == 0) {
+    return list->first;
+  }
+  if (order == ORDER_LIST && position == list->task_count - 1) {
+    return list->last;
+  }
+  need_index(list, order);
+  task = list->index_root[order];
+  while (task) {
+    left = subtree_size(task->node[order].left, order);
+    if (position < left) {
+      task = task->node[order].left;
+    }
+    else if (position == left) {
+      return task;
+    }
+    else {
+      position -= left + 1;
+      task = task->node[order].right;
+    }
+  }
+  return NULL;
+}
+
+TASK *get_next_ordered(TODOLIST *list, int order, TASK *task) {
+  TASK *next = NULL;
+  if (order == ORDER_LIST) {
+    return task->next;
+  }
+  need_index(list, order);
+  next = task->node[order].right;
+  if (next) {
+    while (next->node[order].left) {
+      next = next->node[order].left;
+    }
+    return next;
+  }
+  while (task->node[order].parent
+      && task->node[order].parent->node[order].right == task) {
+    task = task->node[order].parent;
+  }
+  return task->node[order].parent;
+}
+
+/* Find the first (or last if forward is 0) task of a kind in a subtree of an
+ * index. */
+static TASK *find_counted(TASK *task, int order, int kind, int forward) {
+  TASK *near = NULL;
+  if (!subtree_count(task, order, kind)) {
+    return NULL;
+  }
+  while (task) {
+    near = forward ? task->node[order].left : task->node[order].right;
+    if (subtree_count(near, order, kind)) {
+      task = near;
+    }
+    else if (is_counted(task, kind)) {
+      return task;
+    }
+    else {
+      task = forward ? task->node[order].right : task->node[order].left;
+    }
+  }
+  return NULL;
+}
+
+/* Find the nearest task of a kind after (or before) a task in an order, as
+ * find_open_task(). */
+static TASK *find_counted_task(TODOLIST *list, int order, int kind, TASK *task,
+    int forward) {
+  TASK *found = NULL;
+  TASK *parent = NULL;
+  need_index(list, order);
+  if (!task) {
+    return find_counted(list->index_root[order], order, kind, forward);
+  }
+  /* The tasks after task are in the subtree on its right, and in the right
+   * subtrees of the ancestors it is on the left of, nearest first. */
+  found = find_counted(forward ? task->node[order].right
+      : task->node[order].left, order, kind, forward);
+  for (; !found && (parent = task->node[order].parent); task = parent) {
+    if ((forward ? parent->node[order].left : parent->node[order].right)
+        == task) {
+      if (is_counted(parent, kind)) {
+        return parent;
+      }
+      found = find_counted(forward ? parent->node[order].right
+          : parent->node[order].left, order, kind, forward);
+    }
+  }
+  return found;
+}
+
+TASK *find_open_task(TODOLIST *list, int order, TASK *task, int forward) {
+  if (list->done_count == list->task_count) {
+    return NULL;
+  }
+  return find_counted_task(list, order, COUNT_OPEN, task, forward);
+}
+
+/* Find the first (or last if forward is 0) task with at most a depth in a
+ * subtree of the ORDER_LIST index. */
+static TASK *find_shallow(TASK *task, int depth, int forward) {
+  TASK *near = NULL;
+  if (!task || task->min_depth > depth) {
+    return NULL;
+  }
+  while (task) {
+    near = forward ? task->node[ORDER_LIST].left : task->node[ORDER_LIST].right;
+    if (near && near->min_depth <= depth) {
+      task = near;
+    }
+    else if (task->depth <= depth) {
+      return task;
+    }
+    else {
+      task = forward ? task->node[ORDER_LIST].right
+        : task->node[ORDER_LIST].left;
+    }
+  }
+  return NULL;
+}
+
+/* Usually the task found is the next (or previous) task, which is checked
+ * first. */
+TASK *find_shallow_task(TODOLIST *list, TASK *task, int depth, int forward) {
+  TASK *near = forward ? task->next : task->prev;
+  TASK *found = NULL;
+  TASK *parent = NULL;
+  if (!near || near->depth <= depth) {
+    return near;
+  }
+  need_index(list, ORDER_LIST);
+  found = find_shallow(forward ? task->node[ORDER_LIST].right
+      : task->node[ORDER_LIST].left, depth, forward);
+  for (; !found && (parent = task->node[ORDER_LIST].parent); task = parent) {
+    if ((forward ? parent->node[ORDER_LIST].left
+          : parent->node[ORDER_LIST].right) == task) {
+      if (parent->depth <= depth) {
+        return parent;
+      }
+      found = find_shallow(forward ? parent->node[ORDER_LIST].right
+          : parent->node[ORDER_LIST].left, depth, forward);
+    }
+  }
+  return found;
+}
+
+TASK *get_parent_task(TODOLIST *list, TASK *task) {
+  if (!task->depth) {
+    return NULL;
+  }
+  return find_shallow_task(list, task, task->depth - 1, 0);
+}
+
+TASK *get_subtree_end(TODOLIST *list, TASK *task) {
+  return find_shallow_task(list, task, task->depth, 1);
+}
+
+/* Get the number of done tasks before a task in the list, or the number of
+ * done tasks if task is NULL. */
+static size_t get_done_position(TODOLIST *list, TASK *task) {
+  size_t done;
+  TASK *parent = NULL;
+  if (!task) {
+    return list->done_count;
+  }
+  need_index(list, ORDER_LIST);
+  done = task->node[ORDER_LIST].left
+    ? task->node[ORDER_LIST].left->node[ORDER_LIST].done_size : 0;
+  for (; (parent = task->node[ORDER_LIST].parent); task = parent) {
+    if (parent->node[ORDER_LIST].right == task) {
+      done += (parent->done != 0) + (parent->node[ORDER_LIST].left
+          ? parent->node[ORDER_LIST].left->node[ORDER_LIST].done_size : 0);
+    }
+  }
+  return done;
+}
+
+size_t count_subtasks(TODOLIST *list, TASK *task, size_t *done) {
+  TASK *end = get_subtree_end(list, task);
+  if (end == task->next) {
+    *done = 0;
+    return 0;
+  }
+  /* The subtasks are the tasks between task and end. */
+  *done = get_done_position(list, end) - get_done_position(list, task)
+    - (task->done != 0);
+  return get_task_position(list, end) - get_task_position(list, task) - 1;
+}
+
+size_t get_shown_position(TODOLIST *list, int order, TASK *task) {
+  size_t position;
+  TASK *parent = NULL;
+  if (!task) {
+    return list->task_count - list->hidden_count;
+  }
+  if (!list->hidden_count) {
+    return get_ordered_position(list, order, task);
+  }
+  need_index(list, order);
+  position = subtree_count(task->node[order].left, order, COUNT_SHOWN);
+  for (; (parent = task->node[order].parent); task = parent) {
+    if (parent->node[order].right == task) {
+      position += subtree_count(parent->node[order].left, order, COUNT_SHOWN)
+        + !parent->hidden;
+    }
+  }
+  return position;
+}
+
+TASK *get_shown_task(TODOLIST *list, int order, size_t position) {
+  TASK *task = NULL;
+  size_t left;
+  if (!list->hidden_count) {
+    return get_ordered_task(list, order, position);
+  }
+  if (position >= list->task_count - list->hidden_count) {
+    return NULL;
+  }
+  need_index(list, order);
+  task = list->index_root[order];
+  while (task) {
+    left = subtree_count(task->node[order].left, order, COUNT_SHOWN);
+    if (position < left) {
+      task = task->node[order].left;
+    }
+    else if (position == left && !task->hidden) {
+      return task;
+    }
+    else {
+      position -= left + !task->hidden;
+      task = task->node[order].right;
+    }
+  }
+  return NULL;
+}
+
+TASK *find_shown_task(TODOLIST *list, int order, TASK *task, int forward) {
+  TASK *near = NULL;
+  /* In the list order the next (or previous) task is usually shown, so it is
+   * checked before the index is searched. */
+  if (task && order == ORDER_LIST) {
+    near = forward ? task->next : task->prev;
+    if (!near || !near->hidden) {
+      return near;
+    }
+  }
+  if (!list->hidden_count) {
+    if (!task) {
+      return get_ordered_task(list, order, forward ? 0 : list->task_count - 1);
+    }
+    if (forward) {
+      return get_next_ordered(list, order, task);
+    }
+  }
+  if (list->hidden_count == list->task_count) {
+    return NULL;
+  }
+  return find_counted_task(list, order, COUNT_SHOWN, task, forward);
+}
+
+void add_listener(TODOLIST *list, void (*notify)(TODOLIST *, CHANGE *, void *), void *data) {
+  LISTENER *listener = (LISTENER *)malloc(sizeof(LISTENER));
+  if (!listener) {
+    return;
+  }
+  listener->notify = notify;
+  listener->data = data;
+  listener->next = list->listeners;
+  list->listeners = listener;
+}
+
+void remove_listener(TODOLIST *list, void (*notify)(TODOLIST *, CHANGE *, void *), void *data) {
+  LISTENER **link = &list->listeners;
+  LISTENER *listener = NULL;
+  while ((listener = *link)) {
+    if (listener->notify == notify && listener->data == data) {
+      *link = listener->next;
+      free(listener);
+      return;
+    }
+    link = &listener->next;
+  }
+}
+
+/* Copy a string. */
+static char *copy_string(const char *str) {
+  char *copy = (char *)malloc(strlen(str) + 1);
+  if (copy) {
+    strcpy(copy, str);
+  }
+  return copy;
+}
+
+/* Hash an option key (FNV-1a). */
+static unsigned long hash_key(const char *key) {
+  unsigned long hash = 2166136261UL;
+  for (; *key; key++) {
+    hash = (hash ^ (unsigned char)*key) * 16777619UL;
+  }
+  return hash;
+}
+
+/* Find an option by key. Options are only searched linearly if the option
+ * table could not be allocated. */
+static OPTION *find_option(TODOLIST *list, const char *key, unsigned long hash) {
+  OPTION *opt = NULL;
+  if (list->option_table) {
+    opt = list->option_table[hash & (list->option_buckets - 1)];
+    for (; opt; opt = opt->chain) {
+      if (opt->hash == hash && strcmp(key, opt->key) == 0) {
+        return opt;
+      }
+    }
+    return NULL;
+  }
+  for (opt = list->first_option; opt; opt = opt->next) {
     if (strcmp(key, opt->key) == 0) {
-      return opt->value;
+      return opt;
     }
-    opt = opt->next;
   }
   return NULL;
 }
 
+/* Grow the option table, so there is at most one option per bucket on
+ * average. The table is left as it is if there isn't enough memory. */
+static void grow_option_table(TODOLIST *list) {
+  OPTION **table = NULL;
+  OPTION *opt = NULL;
+  size_t buckets = list->option_buckets ? list->option_buckets * 2 : 16;
+  size_t i;
+  if (list->option_count < list->option_buckets) {
+    return;
+  }
+  table = (OPTION **)malloc(buckets * sizeof(OPTION *));
+  if (!table) {
+    return;
+  }
+  for (i = 0; i < buckets; i++) {
+    table[i] = NULL;
+  }
+  for (opt = list->first_option; opt; opt = opt->next) {
+    opt->chain = table[opt->hash & (buckets - 1)];
+    table[opt->hash & (buckets - 1)] = opt;
+  }
+  free(list->option_table);
+  list->option_table = table;
+  list->option_buckets = buckets;
+}
+
+char *get_option(TODOLIST *todolist, const char *key) {
+  OPTION *opt = find_option(todolist, key, hash_key(key));
+  return opt ? opt->value : NULL;
+}
+
 char *copy_option(TODOLIST *todolist, const char *key) {
-  char *copy = NULL;
   char *value = get_option(todolist, key);
-  if (value) {
-    copy = (char *)malloc(strlen(value) + 1);
-    strcpy(copy, value);
-  }
-  return copy;
+  return value ? copy_string(value) : NULL;
 }
 
 int get_option_bit(TODOLIST *todolist, const char *key) {
@@ -138,25 +1412,37 @@ int get_option_bit(TODOLIST *todolist, const char *key) {
 }
 
 void set_option(TODOLIST *list, const char *key, const char *value) {
-  OPTION *opt = list->first_option;
-  while (opt) {
-    if (strcmp(key, opt->key) == 0) {
-      free(opt->value);
-      opt->value = (char *)malloc(strlen(value) + 1);
-      strcpy(opt->value, value);
+  unsigned long hash = hash_key(key);
+  OPTION *opt = find_option(list, key, hash);
+  char *copy = NULL;
+  if (opt) {
+    /* The first value of an option is in the arena. Later values are
+     * allocated separately and freed when they are replaced, so setting an
+     * option repeatedly doesn't grow the arena. */
+    copy = (char *)malloc(strlen(value) + 1);
+    if (!copy) {
       return;
     }
-    opt = opt->next;
+    strcpy(copy, value);
+    if (!arena_contains(&list->arena, opt->value)) {
+      free(opt->value);
+    }
+    opt->value = copy;
+    notify(list, CHANGE_OPTION, NULL, 0, opt->key);
+    return;
   }
-  opt = (OPTION *)malloc(sizeof(OPTION));
-  if (!opt) {
+  copy = arena_copy(&list->arena, value, strlen(value));
+  if (!copy) {
     return;
   }
-  opt->key = (char *)malloc(strlen(key) + 1);
-  strcpy(opt->key, key);
-  opt->value = (char *)malloc(strlen(value) + 1);
-  strcpy(opt->value, value);
+  opt = (OPTION *)arena_alloc(&list->arena, sizeof(OPTION));
+  if (!opt || !(opt->key = arena_copy(&list->arena, key, strlen(key)))) {
+    return;
+  }
+  opt->value = copy;
+  opt->hash = hash;
   opt->next = NULL;
+  opt->chain = NULL;
   if (!list->first_option) {
     list->first_option = opt;
   }
@@ -164,34 +1450,45 @@ void set_option(TODOLIST *list, const char *key, const char *value) {
     list->last_option->next = opt;
   }
   list->last_option = opt;
+  list->option_count++;
+  if (list->option_table) {
+    opt->chain = list->option_table[hash & (list->option_buckets - 1)];
+    list->option_table[hash & (list->option_buckets - 1)] = opt;
+  }
+  grow_option_table(list);
+  notify(list, CHANGE_OPTION, NULL, 0, opt->key);
 }
 
 void set_option_bit(TODOLIST *todolist, const char *key, int bit) {
-  char *value = (char *)malloc(2);
-  value[0] = bit ? '1' : '0';
-  value[1] = '\0';
-  set_option(todolist, key, value);
+  set_option(todolist, key, bit ? "1" : "0");
 }
 
 void delete_todolist(TODOLIST *todolist) {
-  TASK *task = todolist->first;
-  OPTION *opt = todolist->first_option;
-  TASK *temp = NULL;
-  OPTION *temp_opt = NULL;
-  while (task) {
-    temp = task;
-    task = task->next;
-    free(temp->message);
-    free(temp);
-  }
-  while (opt) {
-    temp_opt = opt;
-    opt = opt->next;
-    free(temp_opt->key);
-    free(temp_opt->value);
-    free(temp_opt);
+  TASK *task = NULL;
+  OPTION *opt = NULL;
+  /* Tasks and options are in the arena, so the tasks only need to be visited
+   * if some messages were allocated separately. */
+  for (task = todolist->first; task && todolist->owned_messages; task = task->next) {
+    free_message(todolist, task->message);
+  }
+  for (opt = todolist->first_option; opt; opt = opt->next) {
+    if (!arena_contains(&todolist->arena, opt->value)) {
+      free(opt->value);
+    }
+  }
+  while (todolist->listeners) {
+    remove_listener(todolist, todolist->listeners->notify, todolist->listeners->data);
   }
+  free(todolist->option_table);
   free(todolist->title);
+#ifdef HAVE_MMAP
+  if (todolist->image_mapped) {
+    munmap(todolist->image, todolist->image_size);
+  }
+  else
+#endif
+  free(todolist->image);
+  free_arena(&todolist->arena);
   free(todolist);
 }
 
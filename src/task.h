@@ -9,44 +9,242 @@
 #ifndef TASK_H
 #define TASK_H
 
-/* A task. Part of doubly linked list. */
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* Offset of a task that is not (yet) in the file. */
+#define NO_OFFSET ((size_t)-1)
+
+/* Highest priority, written as "(A)" in front of the message. */
+#define PRIORITY_MIN 1
+/* Lowest priority, "(Z)". A priority of 0 means that the task has none. */
+#define PRIORITY_MAX 26
+
+/* Greatest depth of a task. */
+#define DEPTH_MAX 255
+
+/* Orders in which the tasks of a list can be viewed, each of which has an
+ * index (see TODOLIST). */
+#define ORDER_LIST 0 /* The order of the list. */
+#define ORDER_PRIORITY 1 /* By priority, then in the order of the list. Tasks
+                            without a priority come last. */
+#define ORDER_COUNT 2
+
+struct TASK;
+
+/* The links of a task in an index. */
+typedef struct INDEX_NODE {
+  struct TASK *parent; /* Parent of task. */
+  struct TASK *left; /* Subtree of tasks before task. */
+  struct TASK *right; /* Subtree of tasks after task. */
+  size_t size; /* Number of tasks in subtree of task. */
+  size_t done_size; /* Number of done tasks in subtree of task. */
+  size_t hidden_size; /* Number of hidden tasks in subtree of task. */
+} INDEX_NODE;
+
+/* A task. Part of doubly linked list, and of the indexes of the list. */
 typedef struct TASK {
   char *message; /* Task text */
   int done; /* Done (1) or not done (0). */
-  int priority; /* Unused. */
+  int priority; /* Priority from PRIORITY_MIN to PRIORITY_MAX, or 0. */
+  int hidden; /* Whether the task is hidden by a view (see view.h), and
+                 why, or 0 if it is shown. */
+  int depth; /* Number of levels the task is indented by. It is a subtask of
+                the nearest task before it with a smaller depth. */
+  size_t offset; /* Offset of the task in the file when the list was last
+                    loaded or saved, or NO_OFFSET. */
   struct TASK *next; /* Next task in list. */
   struct TASK *prev; /* Previous task in list. */
+  INDEX_NODE node[ORDER_COUNT]; /* Links of task in each index. */
+  unsigned int weight; /* Random weight of task, which is greater than or equal
+                          to that of its children in each index. */
+  unsigned int search_id; /* Identifier of task in the search index (see
+                             search.h), or 0. */
+  int min_depth; /* Smallest depth in the subtree of task in the ORDER_LIST
+                    index. */
+  int collapsed; /* Whether the subtasks of task are hidden by a view. */
 } TASK;
 
-/* An option. Part of singly linked list. */
+/* An option. Part of singly linked list, which is kept in insertion order,
+ * and of a chain in the option table of the list. */
 typedef struct OPTION {
   char *key; /* Option key, left side of '='. */
   char *value; /* Option value, right side of '='. */
+  unsigned long hash; /* Hash of key. */
   struct OPTION *next; /* Next option in list. */
+  struct OPTION *chain; /* Next option in the same bucket. */
 } OPTION;
 
-/* A list of tasks and options. */
+/* Types of changes reported to listeners. */
+#define CHANGE_INSERT 1 /* A task was inserted. */
+#define CHANGE_DELETE 2 /* A task is about to be deleted. */
+#define CHANGE_MOVE 3 /* A task was moved. */
+#define CHANGE_DONE 4 /* The done flag of a task was changed. */
+#define CHANGE_MESSAGE 5 /* The message of a task was changed. */
+#define CHANGE_TITLE 6 /* The list title was changed. */
+#define CHANGE_OPTION 7 /* An option was set. */
+#define CHANGE_PRIORITY 8 /* The priority of a task was changed. */
+#define CHANGE_DEPTH 9 /* The depth of a task was changed. */
+
+/* A change to a list. */
 typedef struct {
+  int type; /* Type of change. */
+  TASK *task; /* Changed task, or NULL for title and option changes. */
+  size_t position; /* Position of task (after moving it). */
+  size_t old_position; /* Position of a task before moving it, or priority
+                          or depth before changing it. */
+  const char *old_value; /* Old message or title, or option key. */
+} CHANGE;
+
+struct TODOLIST;
+
+/* A function that is called after each change to a list (before deleting a
+ * task). Part of singly linked list. */
+typedef struct LISTENER {
+  void (*notify)(struct TODOLIST *list, CHANGE *change, void *data);
+  void *data; /* Data passed to notify. */
+  struct LISTENER *next; /* Next listener. */
+} LISTENER;
+
+/* A list of tasks and options. */
+typedef struct TODOLIST {
   char *title; /* List title. */
   TASK *first; /* First task in list. */
   TASK *last; /* Last task in list. */
   OPTION *first_option; /* First option in list. */
   OPTION *last_option; /* Last option in list. */
+  OPTION **option_table; /* Options by hash of key, or NULL. */
+  size_t option_buckets; /* Number of buckets in option_table, a power of
+                            two. */
+  size_t option_count; /* Number of options. */
+  LISTENER *listeners; /* Listeners notified of changes. */
+  size_t dirty_offset; /* Offset in the file of the first change since the
+                          list was loaded or saved, or NO_OFFSET. */
+  size_t clean_end; /* Offset in the file of the end of the part that is
+                       written exactly as the list would be saved. */
+  size_t file_size; /* Size of the file when the list was last loaded or
+                       saved, or NO_OFFSET. */
+  long file_mtime; /* Modification time of the file when the list was last
+                      loaded or saved. */
+  char *image; /* Content of the file the list was loaded from, which task
+                  messages may point into, or NULL. */
+  size_t image_size; /* Size of image. */
+  int image_mapped; /* Whether image is a memory mapping rather than allocated
+                       with malloc(). */
+  ARENA arena; /* Memory for tasks, options, and messages that are copied by
+                  the parser. Released when the list is deleted. */
+  TASK *free_tasks; /* Deleted tasks that can be reused. */
+  TASK *slab_next; /* Next unused task in the current slab. */
+  TASK *slab_end; /* End of the current slab. */
+  size_t owned_messages; /* Number of messages that must be freed, i.e. that
+                            aren't in image or arena. */
+  size_t task_count; /* Number of tasks. */
+  size_t done_count; /* Number of done tasks. */
+  size_t hidden_count; /* Number of hidden tasks. */
+  size_t hidden_done_count; /* Number of hidden tasks that are done. */
+  TASK *index_root[ORDER_COUNT]; /* Root of the index of each order, a treap
+                                    of the tasks, which is used to convert
+                                    between tasks and positions in logarithmic
+                                    time. */
+  int indexed[ORDER_COUNT]; /* Whether each index is up to date. An index is
+                               built when it is first needed, and then updated
+                               by the functions below. */
+  unsigned int index_seed; /* State of the generator of task weights. */
 } TODOLIST;
 
+/* Create an empty list. The title is freed when the list is deleted.
+ *
+ * Messages passed to the functions below must have been allocated with
+ * malloc(), or point into the image or arena of the list. They are freed
+ * when they are replaced or the task is deleted, unless they are in the image
+ * or arena. */
+TODOLIST *new_todolist(char *title);
+
 /* Delete a list and all associated tasks and options. */
 void delete_todolist(TODOLIST *todolist);
 
 /* Remove a task from a list and delete it. */
 void delete_task(TASK *delete, TODOLIST *list);
 /* Add a task to the end of a list. */
-void add_task(TODOLIST *list, char *message, int done, int priority);
+void add_task(TODOLIST *list, char *message, int done, int priority,
+    int depth);
 /* Insert a task before another one. */
-void insert_task(TODOLIST *list, TASK *next, char *message, int done, int priority);
+void insert_task(TODOLIST *list, TASK *next, char *message, int done,
+    int priority, int depth);
 /* Move a task up. */
 void move_task_up(TODOLIST *list, TASK *task);
 /* Move a task down. */
 void move_task_down(TODOLIST *list, TASK *task);
+/* Move a task to another position, i.e. before another task (or to the end of
+ * the list if next is NULL). */
+void move_task(TODOLIST *list, TASK *task, TASK *next);
+/* Delete the tasks from first to last, which must be in that order, in a
+ * single splice. Listeners are notified of each deletion. */
+void delete_tasks(TODOLIST *list, TASK *first, TASK *last);
+/* Delete all done tasks in a single pass. Returns the number of deleted
+ * tasks. */
+size_t delete_done_tasks(TODOLIST *list);
+/* Move the tasks from first to last, which must be in that order, before
+ * another task (or to the end of the list if next is NULL) in a single splice.
+ * next must not be one of the moved tasks. */
+void move_tasks(TODOLIST *list, TASK *first, TASK *last, TASK *next);
+/* Check or uncheck a task. */
+void set_task_done(TODOLIST *list, TASK *task, int done);
+/* Change the priority of a task. */
+void set_task_priority(TODOLIST *list, TASK *task, int priority);
+/* Change the depth of a task, which is at most DEPTH_MAX. */
+void set_task_depth(TODOLIST *list, TASK *task, int depth);
+/* Replace the message of a task. The old message is freed. */
+void set_task_message(TODOLIST *list, TASK *task, char *message);
+/* Replace the title of a list. The old title is freed. */
+void set_title(TODOLIST *list, char *title);
+/* Hide or show a task. The reason for hiding it, if any, is stored as the
+ * hidden flag. Listeners are not notified, since the list itself doesn't
+ * change. */
+void set_task_hidden(TODOLIST *list, TASK *task, int hidden);
+
+/* Get the position of a task in a list, or the number of tasks if task is
+ * NULL. */
+size_t get_task_position(TODOLIST *list, TASK *task);
+/* Get the task at a position in a list, or NULL if out of range. */
+TASK *get_task_at(TODOLIST *list, size_t position);
+/* Get the position of a task in an order, or the number of tasks if task is
+ * NULL. */
+size_t get_ordered_position(TODOLIST *list, int order, TASK *task);
+/* Get the task at a position in an order, or NULL if out of range. */
+TASK *get_ordered_task(TODOLIST *list, int order, size_t position);
+/* Get the task after a task in an order, or NULL if it is the last. */
+TASK *get_next_ordered(TODOLIST *list, int order, TASK *task);
+/* Find the nearest task after (or before if forward is 0) a task in an order
+ * that isn't done. Starts at the first (or last) task if task is NULL. Returns
+ * NULL if there is no such task. */
+TASK *find_open_task(TODOLIST *list, int order, TASK *task, int forward);
+/* Find the nearest task after (or before if forward is 0) a task in the list
+ * whose depth is at most depth. Returns NULL if there is no such task. */
+TASK *find_shallow_task(TODOLIST *list, TASK *task, int depth, int forward);
+/* Get the task that a task is a subtask of, or NULL. */
+TASK *get_parent_task(TODOLIST *list, TASK *task);
+/* Get the first task after the subtasks of a task in the list, or NULL if
+ * there is none. */
+TASK *get_subtree_end(TODOLIST *list, TASK *task);
+/* Get the number of subtasks of a task, including their subtasks. The number of
+ * those that are done is stored in done. */
+size_t count_subtasks(TODOLIST *list, TASK *task, size_t *done);
+/* Get the number of tasks that aren't hidden before a task in an order, or the
+ * number of tasks that aren't hidden if task is NULL. */
+size_t get_shown_position(TODOLIST *list, int order, TASK *task);
+/* Get the task at a position among the tasks that aren't hidden in an order,
+ * or NULL if out of range. */
+TASK *get_shown_task(TODOLIST *list, int order, size_t position);
+/* Find the nearest task after (or before if forward is 0) a task in an order
+ * that isn't hidden, as find_open_task(). */
+TASK *find_shown_task(TODOLIST *list, int order, TASK *task, int forward);
+
+/* Add a listener that is notified of changes to a list. */
+void add_listener(TODOLIST *list, void (*notify)(TODOLIST *, CHANGE *, void *), void *data);
+/* Remove a listener. */
+void remove_listener(TODOLIST *list, void (*notify)(TODOLIST *, CHANGE *, void *), void *data);
 
 /* Get the value of an option. */
 char *get_option(TODOLIST *todolist, const char *key);
@@ -55,7 +253,7 @@ char *get_option(TODOLIST *todolist, const char *key);
 char *copy_option(TODOLIST *todolist, const char *key);
 /* Get binary value of an option (0 if not set or "0", 1 otherwise). */
 int get_option_bit(TODOLIST *todolist, const char *key);
-/* Set value of an option. */
+/* Set value of an option. New options are added after existing ones. */
 void set_option(TODOLIST *list, const char *key, const char *value);
 /* Get binary value of an option. */
 void set_option_bit(TODOLIST *todolist, const char *key, int bit);
@@ -0,0 +1,179 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdlib.h>
+
+#include "view.h"
+#include "search.h"
+#include "stream.h"
+#include "error.h"
+
+struct VIEW {
+  int hide_done; /* Whether done tasks are hidden. */
+  QUERY *query; /* Text that shown tasks contain, or NULL. */
+  size_t collapsed_count; /* Number of collapsed tasks. */
+};
+
+/* Whether the filter of a view hides a task. */
+static int is_hidden(VIEW *view, TASK *task) {
+  return (view->hide_done && task->done)
+    || (view->query && !query_matches(view->query, task->message));
+}
+
+/* Check a task against the filter of a view, keeping it folded or not. */
+static void filter_task(VIEW *view, TODOLIST *list, TASK *task, int folded) {
+  set_task_hidden(list, task, (is_hidden(view, task) ? HIDDEN_FILTER : 0)
+      | (folded ? HIDDEN_FOLDED : 0));
+}
+
+/* Find out again which tasks are folded, starting with task and continuing
+ * with the following tasks that are deeper than depth. The tasks come after
+ * context, or are the first in the list if it is NULL.
+ *
+ * A task is folded if one of its ancestors is collapsed, so only the
+ * shallowest collapsed ancestor of the current task needs to be known. */
+static void fold_tasks(VIEW *view, TODOLIST *list, TASK *task, TASK *context,
+    int depth) {
+  TASK *first = task;
+  int fold = -1;
+  for (; context; context = get_parent_task(list, context)) {
+    if (context->collapsed) {
+      fold = context->depth;
+    }
+  }
+  for (; task && (task == first || task->depth > depth); task = task->next) {
+    if (task->depth <= fold) {
+      fold = -1;
+    }
+    filter_task(view, list, task, fold >= 0);
+    if (fold < 0 && task->collapsed) {
+      fold = task->depth;
+    }
+  }
+}
+
+static void update_view(TODOLIST *list, CHANGE *change, void *data) {
+  VIEW *view = (VIEW *)data;
+  TASK *task = change->task;
+  TASK *next = NULL;
+  if (!view->collapsed_count) {
+    if (!view->hide_done && !view->query) {
+      return;
+    }
+    switch (change->type) {
+      case CHANGE_INSERT:
+      case CHANGE_DONE:
+      case CHANGE_MESSAGE:
+        filter_task(view, list, task, 0);
+        break;
+    }
+    return;
+  }
+  /* The subtasks of a task that is inserted, deleted, moved or indented
+   * may have other ancestors afterwards. */
+  switch (change->type) {
+    case CHANGE_INSERT:
+      fold_tasks(view, list, task, task->prev, task->depth);
+      break;
+    case CHANGE_DEPTH:
+      fold_tasks(view, list, task, task->prev,
+          task->depth < (int)change->old_position ? task->depth
+          : (int)change->old_position);
+      break;
+    case CHANGE_DELETE:
+      if (task->collapsed) {
+        task->collapsed = 0;
+        view->collapsed_count--;
+      }
+      /* The task is still in the list. */
+      if (task->next) {
+        fold_tasks(view, list, task->next, task->prev, task->depth);
+      }
+      break;
+    case CHANGE_MOVE:
+      fold_tasks(view, list, task, task->prev, task->depth);
+      /* The task that came after the moved task. */
+      next = get_task_at(list, change->old_position
+          + (change->position < change->old_position));
+      if (next && next != task && next->depth > task->depth) {
+        fold_tasks(view, list, next, next->prev, task->depth);
+      }
+      break;
+    case CHANGE_DONE:
+    case CHANGE_MESSAGE:
+      filter_task(view, list, task, task->hidden & HIDDEN_FOLDED);
+      break;
+  }
+}
+
+VIEW *open_view(TODOLIST *todolist) {
+  VIEW *view = (VIEW *)malloc(sizeof(VIEW));
+  if (!view) {
+    error("Could not allocate memory");
+    return NULL;
+  }
+  view->hide_done = 0;
+  view->query = NULL;
+  view->collapsed_count = 0;
+  add_listener(todolist, update_view, view);
+  return view;
+}
+
+int set_view_filter(VIEW *view, TODOLIST *todolist, int hide_done,
+    const char *query) {
+  TASK *task = NULL;
+  QUERY *folded = NULL;
+  /* The query is converted to lower case once, rather than for each task. */
+  if (query) {
+    folded = new_query(query);
+    if (!folded) {
+      return 0;
+    }
+  }
+  if (view->query) {
+    delete_query(view->query);
+  }
+  view->query = folded;
+  view->hide_done = hide_done;
+  if (!hide_done && !query && !todolist->hidden_count) {
+    return 1;
+  }
+  for (task = todolist->first; task; task = task->next) {
+    filter_task(view, todolist, task, task->hidden & HIDDEN_FOLDED);
+  }
+  return 1;
+}
+
+int set_task_collapsed(VIEW *view, TODOLIST *todolist, TASK *task,
+    int collapsed) {
+  TASK *next = task->next;
+  collapsed = collapsed != 0;
+  if (task->collapsed == collapsed) {
+    return 1;
+  }
+  if (collapsed && (!next || next->depth <= task->depth)) {
+    return 0;
+  }
+  task->collapsed = collapsed;
+  view->collapsed_count += collapsed ? 1 : -1;
+  if (next && next->depth > task->depth) {
+    fold_tasks(view, todolist, next, task, task->depth);
+  }
+  return 1;
+}
+
+void close_view(VIEW *view, TODOLIST *todolist) {
+  TASK *task = NULL;
+  remove_listener(todolist, update_view, view);
+  if (view->collapsed_count) {
+    for (task = todolist->first; task; task = task->next) {
+      task->collapsed = 0;
+      set_task_hidden(todolist, task, task->hidden & HIDDEN_FILTER);
+    }
+  }
+  set_view_filter(view, todolist, 0, NULL);
+  free(view);
+}
@@ -0,0 +1,47 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Filtered views of a list. The tasks that don't pass the filter of a view are
+ * marked as hidden (see set_task_hidden()), and the indexes of the list count
+ * the hidden tasks, so the shown tasks are found by their position in a view in
+ * logarithmic time (see get_shown_task()).
+ *
+ * Changing the filter checks every task, after which only the tasks that are
+ * inserted, checked or edited are checked again.
+ *
+ * The subtasks of a collapsed task are hidden as well (folded). Which tasks
+ * are folded is found out again for the subtasks of a task that is inserted,
+ * deleted, moved or indented. Ranges of tasks that are moved or deleted at
+ * once (see move_tasks()) must consist of whole subtrees, since a range is
+ * reported as if its tasks were moved one at a time. */
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "task.h"
+
+/* Reasons for hiding a task, see set_task_hidden(). */
+#define HIDDEN_FILTER 1 /* The task doesn't pass the filter. */
+#define HIDDEN_FOLDED 2 /* An ancestor of the task is collapsed. */
+
+/* View type */
+typedef struct VIEW VIEW;
+
+/* Start keeping the tasks of a list hidden or shown according to a filter.
+ * Initially all tasks are shown. */
+VIEW *open_view(TODOLIST *todolist);
+/* Change the filter of a view. Done tasks are hidden if hide_done is 1, and
+ * tasks whose messages don't contain the query (ignoring case) are hidden
+ * unless it is NULL. Returns 0 on error. */
+int set_view_filter(VIEW *view, TODOLIST *todolist, int hide_done,
+    const char *query);
+/* Collapse (hide the subtasks of) a task, or expand it if collapsed is 0.
+ * Returns 0 if the task has no subtasks to collapse. */
+int set_task_collapsed(VIEW *view, TODOLIST *todolist, TASK *task,
+    int collapsed);
+/* Show all tasks again and stop keeping track of changes to the list. */
+void close_view(VIEW *view, TODOLIST *todolist);
+
+#endif
@@ -0,0 +1,350 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "writer.h"
+#include "file.h"
+#include "stream.h"
+#include "error.h"
+
+/* A queued save. */
+typedef struct JOB {
+  char *filename; /* Destination file. */
+  char *data; /* Data to write. */
+  size_t length; /* Length of data. */
+  size_t offset; /* Offset in file for WRITE_PATCH. */
+  int mode; /* WRITE_REPLACE, WRITE_APPEND, WRITE_PATCH or WRITE_CACHE. */
+  struct JOB *next; /* Next job in queue. */
+} JOB;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_finished = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static int writer_started = 0;
+static int writer_stopping = 0;
+
+/* Queued jobs that haven't been started yet. */
+static JOB *first_job = NULL;
+static JOB *last_job = NULL;
+/* Number of queued and running jobs, not counting cache writes. */
+static int pending = 0;
+/* Number of jobs finished since the last poll. */
+static int finished = 0;
+/* Error number of the first failed job since the last poll. */
+static int failed_errno = 0;
+
+static void delete_job(JOB *job) {
+  free(job->filename);
+  free(job->data);
+  free(job);
+}
+
+/* Write a buffer to a file descriptor, retrying after partial writes. */
+static int write_all(int fd, const char *data, size_t length) {
+  ssize_t n;
+  while (length > 0) {
+    n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    data += n;
+    length -= n;
+  }
+  return 1;
+}
+
+/* Replace the content of a file by writing to a temporary file and renaming it.
+ * Sets errno and returns 0 on failure. */
+static int replace_file(const char *filename, const char *data, size_t length) {
+  struct stat st;
+  mode_t mask;
+  int fd, saved_errno;
+  char *temp = string_printf("%s.XXXXXX", filename);
+  if (!temp) {
+    errno = ENOMEM;
+    return 0;
+  }
+  fd = mkstemp(temp);
+  if (fd < 0) {
+    saved_errno = errno;
+    free(temp);
+    errno = saved_errno;
+    return 0;
+  }
+  /* mkstemp() creates the file with mode 0600, so the permissions of the
+   * original file (or the default permissions for new files) are applied to
+   * it. */
+  if (stat(filename, &st) == 0) {
+    fchmod(fd, st.st_mode & 07777);
+  }
+  else {
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+  if (!write_all(fd, data, length) || fsync(fd) != 0) {
+    saved_errno = errno;
+    close(fd);
+    unlink(temp);
+    free(temp);
+    errno = saved_errno;
+    return 0;
+  }
+  if (close(fd) != 0 || rename(temp, filename) != 0) {
+    saved_errno = errno;
+    unlink(temp);
+    free(temp);
+    errno = saved_errno;
+    return 0;
+  }
+  free(temp);
+  return 1;
+}
+
+/* Append to a file, creating it if it doesn't exist. Sets errno and returns 0
+ * on failure. */
+static int append_file(const char *filename, const char *data, size_t length) {
+  int saved_errno;
+  int fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd < 0) {
+    return 0;
+  }
+  if (!write_all(fd, data, length) || fsync(fd) != 0) {
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return 0;
+  }
+  return close(fd) == 0;
+}
+
+/* Replace the content of a file from an offset. Sets errno and returns 0 on
+ * failure. */
+static int patch_file(const char *filename, const char *data, size_t length,
+    size_t offset) {
+  int saved_errno;
+  int fd = open(filename, O_WRONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  if (lseek(fd, offset, SEEK_SET) < 0 || !write_all(fd, data, length)
+      || ftruncate(fd, offset + length) != 0 || fsync(fd) != 0) {
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return 0;
+  }
+  return close(fd) == 0;
+}
+
+static void *writer_main(void *arg) {
+  JOB *job = NULL;
+  int status, saved_errno;
+  (void)arg;
+  pthread_mutex_lock(&lock);
+  while (1) {
+    while (!first_job && !writer_stopping) {
+      pthread_cond_wait(&job_queued, &lock);
+    }
+    if (!first_job) {
+      break;
+    }
+    job = first_job;
+    first_job = job->next;
+    if (!first_job) {
+      last_job = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+    if (job->mode == WRITE_APPEND) {
+      status = append_file(job->filename, job->data, job->length);
+    }
+    else if (job->mode == WRITE_PATCH) {
+      status = patch_file(job->filename, job->data, job->length, job->offset);
+    }
+    else {
+      status = replace_file(job->filename, job->data, job->length);
+    }
+    saved_errno = errno;
+    pthread_mutex_lock(&lock);
+    if (job->mode != WRITE_CACHE) {
+      if (!status && !failed_errno) {
+        failed_errno = saved_errno ? saved_errno : EIO;
+      }
+      pending--;
+      finished++;
+    }
+    delete_job(job);
+    pthread_cond_broadcast(&job_finished);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+/* Add a job to the queue. */
+static int queue_job(const char *filename, char *data, size_t length,
+    size_t offset, int mode) {
+  JOB *job = NULL;
+  JOB *queued = NULL;
+  JOB *last = NULL;
+  char path[PATH_MAX];
+  job = (JOB *)malloc(sizeof(JOB));
+  if (!job) {
+    free(data);
+    error("Could not allocate memory");
+    return 0;
+  }
+  /* Saving through a symbolic link replaces the file it points to. */
+  if (realpath(filename, path)) {
+    filename = path;
+  }
+  job->filename = string_printf("%s", filename);
+  job->data = data;
+  job->length = length;
+  job->offset = offset;
+  job->mode = mode;
+  job->next = NULL;
+  if (!job->filename || !job->data) {
+    delete_job(job);
+    error("Could not allocate memory");
+    return 0;
+  }
+  pthread_mutex_lock(&lock);
+  if (!writer_started) {
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+      pthread_mutex_unlock(&lock);
+      delete_job(job);
+      error("Could not start writer thread");
+      return 0;
+    }
+    writer_started = 1;
+  }
+  /* If the last queued job for the file replaces it and hasn't been started,
+   * it is superseded by a new replacement. */
+  for (queued = first_job; queued; queued = queued->next) {
+    if (strcmp(queued->filename, job->filename) == 0) {
+      last = queued;
+    }
+  }
+  if (last && last->mode == mode
+      && (mode == WRITE_REPLACE || mode == WRITE_CACHE)) {
+    free(last->data);
+    last->data = job->data;
+    last->length = job->length;
+    job->data = NULL;
+    delete_job(job);
+    pthread_mutex_unlock(&lock);
+    return 1;
+  }
+  if (last_job) {
+    last_job->next = job;
+  }
+  else {
+    first_job = job;
+  }
+  last_job = job;
+  if (mode != WRITE_CACHE) {
+    pending++;
+  }
+  pthread_cond_signal(&job_queued);
+  pthread_mutex_unlock(&lock);
+  return 1;
+}
+
+int write_file_async(const char *filename, char *data, size_t length, int mode) {
+  return queue_job(filename, data, length, 0, mode);
+}
+
+int patch_file_async(const char *filename, char *data, size_t length, size_t offset) {
+  return queue_job(filename, data, length, offset, WRITE_PATCH);
+}
+
+int save_todolist_async(TODOLIST *todolist, const char *filename) {
+  size_t min_offset = NO_OFFSET;
+  size_t offset, length;
+  char *data = NULL;
+  /* The file is only patched if it is known to contain the list as it was last
+   * loaded or saved, which isn't the case while another save is queued. */
+  if (!save_pending() && file_unchanged(todolist, filename)) {
+    min_offset = todolist->file_size / 2;
+  }
+  data = stringify_changes(todolist, min_offset, &offset, &length);
+  if (!data) {
+    return 0;
+  }
+  if (offset == 0) {
+    return write_file_async(filename, data, length, WRITE_REPLACE);
+  }
+  return patch_file_async(filename, data, length, offset);
+}
+
+int save_pending() {
+  int result;
+  pthread_mutex_lock(&lock);
+  result = pending > 0;
+  pthread_mutex_unlock(&lock);
+  return result;
+}
+
+/* Collect the results of finished jobs. Must be called with the lock held. */
+static int collect_results() {
+  int result = 1;
+  if (!finished) {
+    return -1;
+  }
+  if (failed_errno) {
+    error("%s", strerror(failed_errno));
+    failed_errno = 0;
+    result = 0;
+  }
+  finished = 0;
+  return result;
+}
+
+int poll_save() {
+  int result;
+  pthread_mutex_lock(&lock);
+  result = pending > 0 ? -1 : collect_results();
+  pthread_mutex_unlock(&lock);
+  return result;
+}
+
+int wait_for_save() {
+  int result;
+  pthread_mutex_lock(&lock);
+  while (pending > 0) {
+    pthread_cond_wait(&job_finished, &lock);
+  }
+  result = collect_results();
+  pthread_mutex_unlock(&lock);
+  return result;
+}
+
+void stop_writer() {
+  pthread_mutex_lock(&lock);
+  if (!writer_started) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  writer_stopping = 1;
+  pthread_cond_signal(&job_queued);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer_thread, NULL);
+  writer_started = 0;
+  writer_stopping = 0;
+}
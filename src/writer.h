@@ -0,0 +1,52 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Saves lists on a background thread, so the user interface doesn't block
+ * while writing to slow disks.
+ *
+ * A snapshot of the list is serialized when the save is queued, so the list
+ * can be edited while the snapshot is written. Files are replaced atomically
+ * by writing to a temporary file in the same directory, which is synced to
+ * disk and then renamed.
+ *
+ * When only tasks near the end of a list have changed since it was loaded or
+ * saved, and the file hasn't been modified by anyone else, only the tail of
+ * the file starting at the first changed task is rewritten in place. This is
+ * not atomic, so a full rewrite is used whenever the changes start in the first
+ * half of the file. */
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "task.h"
+
+/* Write modes. */
+#define WRITE_REPLACE 0 /* Atomically replace the file. */
+#define WRITE_APPEND 1 /* Append to the file. */
+#define WRITE_PATCH 2 /* Replace the file from an offset. */
+#define WRITE_CACHE 3 /* Atomically replace a cache file. Failures are ignored,
+                         and the job isn't reported as a pending save. */
+
+/* Queue data to be written to a file. Jobs are carried out in the order they
+ * were queued. The data is freed when it has been written. Returns 0 on
+ * error. */
+int write_file_async(const char *filename, char *data, size_t length, int mode);
+/* Queue data to replace the content of a file from an offset. */
+int patch_file_async(const char *filename, char *data, size_t length, size_t offset);
+/* Queue a snapshot of a list to be saved. Returns 0 if the snapshot could not
+ * be created. */
+int save_todolist_async(TODOLIST *todolist, const char *filename);
+/* Whether any queued writes have not finished yet. */
+int save_pending();
+/* Get the result of saves that finished since the last call: -1 if none
+ * finished, 0 if any of them failed (see get_last_error()), 1 otherwise. */
+int poll_save();
+/* Wait for all queued saves to finish. Returns the same as poll_save(), so -1
+ * if nothing was queued since the results were last collected. */
+int wait_for_save();
+/* Wait for queued saves and stop the writer thread. */
+void stop_writer();
+
+#endif
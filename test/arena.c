@@ -0,0 +1,75 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that arena_contains() finds the memory allocated from an arena,
+ * including memory moved into it by arena_merge(), and nothing else. */
+
+#include "test.h"
+#include "arena.h"
+
+/* Number of allocations from each arena. */
+#define ALLOCATIONS 5000
+
+/* Allocate memory of random sizes from an arena, sometimes larger than a
+ * block. */
+static void allocate(ARENA *arena, char **ptrs, size_t *sizes,
+    unsigned long *state) {
+  int i;
+  for (i = 0; i < ALLOCATIONS; i++) {
+    sizes[i] = test_random(state) % 10 == 0 ? test_random(state) % 100000
+      : test_random(state) % 100;
+    ptrs[i] = (char *)arena_alloc(arena, sizes[i]);
+    CHECK(ptrs[i] != NULL);
+  }
+}
+
+/* Check that the first and last byte of each allocation is in an arena. */
+static void check_contains(ARENA *arena, char **ptrs, size_t *sizes) {
+  int i;
+  for (i = 0; i < ALLOCATIONS; i++) {
+    CHECK(arena_contains(arena, ptrs[i]));
+    if (sizes[i] > 0) {
+      CHECK(arena_contains(arena, ptrs[i] + sizes[i] - 1));
+    }
+  }
+}
+
+int main() {
+  static char *ptrs[2][ALLOCATIONS];
+  static size_t sizes[2][ALLOCATIONS];
+  unsigned long state = 1;
+  ARENA arena, other;
+  char *outside = (char *)malloc(64);
+  int i;
+  init_arena(&arena);
+  init_arena(&other);
+  CHECK(!arena_contains(&arena, outside));
+  allocate(&arena, ptrs[0], sizes[0], &state);
+  allocate(&other, ptrs[1], sizes[1], &state);
+  check_contains(&arena, ptrs[0], sizes[0]);
+  check_contains(&other, ptrs[1], sizes[1]);
+  CHECK(!arena_contains(&arena, outside));
+  for (i = 0; i < ALLOCATIONS; i++) {
+    CHECK(!arena_contains(&arena, ptrs[1][i]));
+    CHECK(!arena_contains(&other, ptrs[0][i]));
+  }
+
+  CHECK(arena_merge(&arena, &other));
+  check_contains(&arena, ptrs[0], sizes[0]);
+  check_contains(&arena, ptrs[1], sizes[1]);
+  CHECK(!arena_contains(&other, ptrs[1][0]));
+  CHECK(!arena_contains(&arena, outside));
+
+  /* The merged arena can still be allocated from. */
+  allocate(&arena, ptrs[1], sizes[1], &state);
+  check_contains(&arena, ptrs[0], sizes[0]);
+  check_contains(&arena, ptrs[1], sizes[1]);
+
+  free_arena(&arena);
+  free_arena(&other);
+  free(outside);
+  return failures != 0;
+}
@@ -0,0 +1,179 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that a list read in parallel chunks is the same as the list read on a
+ * single thread, wherever the chunks are split, whether it is parsed from a
+ * string or loaded from a file. */
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+
+/* Greatest number of chunks a list is split into. */
+#define MAX_CHUNKS 64
+
+/* Kinds of test files. */
+#define FILE_CRLF 0 /* Lines end with "\r\n". */
+#define FILE_NO_NEWLINE 1 /* The last line doesn't end with a newline. */
+#define FILE_UTF8 2 /* Messages contain multibyte characters. */
+#define FILE_COUNT 3
+
+static const char *words[] = {"buy", "milk", "(B)", "call", "Bob", "x",
+  "tab\there", "  spaced", "ünïcødé", "日本語", "🎉", "\\"};
+
+/* Make the content of a test file with a title and the given number of
+ * lines. */
+static char *make_file(int kind, int lines, unsigned long *state) {
+  STREAM *output = stream_new_buffer(1024);
+  const char *newline = kind == FILE_CRLF ? "\r\n" : "\n";
+  unsigned long words_count = kind == FILE_UTF8 ? 12 : 8;
+  unsigned long count;
+  int i;
+  if (!output) {
+    return NULL;
+  }
+  stream_printf(output, "Chunk test%s", newline);
+  for (i = 0; i < lines; i++) {
+    switch (test_random(state) % 8) {
+      case 0:
+        /* Options, of which one is continued on the next line. */
+        stream_printf(output, "# a=%d b=c\\%sd%s", i, newline, newline);
+        break;
+      case 1:
+        stream_printf(output, "%s", newline);
+        break;
+      default:
+        stream_printf(output, "%*s[%c] %s", (int)(test_random(state) % 3) * 2,
+            "", test_random(state) % 3 ? ' ' : 'x',
+            test_random(state) % 4 ? "" : "(C) ");
+        stream_printf(output, "task %d", i);
+        for (count = test_random(state) % 4; count > 0; count--) {
+          stream_printf(output, " %s", words[test_random(state) % words_count]);
+        }
+        stream_printf(output, "%s", newline);
+        break;
+    }
+  }
+  if (kind == FILE_NO_NEWLINE) {
+    stream_printf(output, "[ ] last");
+  }
+  return stream_close_buffer(output, NULL);
+}
+
+/* Count the chunks of a file whose first byte, before it is moved to the start
+ * of a line, is in the middle of a line ending, the last line, or a multibyte
+ * character, given the way read_chunks() in file.c splits the content after
+ * the title. */
+static void count_splits(const char *content, size_t chunks, int *splits) {
+  const char *start = strchr(content, '\n') + 1;
+  size_t length = strlen(start);
+  const char *pos = NULL;
+  size_t i;
+  for (i = 1; i < chunks; i++) {
+    pos = start + i * (length / chunks);
+    if (*pos == '\r') {
+      splits[FILE_CRLF]++;
+    }
+    if (!memchr(pos, '\n', length - (pos - start))) {
+      splits[FILE_NO_NEWLINE]++;
+    }
+    if ((*pos & 0xc0) == 0x80) {
+      splits[FILE_UTF8]++;
+    }
+  }
+}
+
+/* Check that two lists have the same tasks and options. */
+static void check_same(TODOLIST *actual, TODOLIST *expected) {
+  TASK *a = actual->first;
+  TASK *e = expected->first;
+  OPTION *oa = actual->first_option;
+  OPTION *oe = expected->first_option;
+  CHECK_STR(actual->title, expected->title);
+  CHECK(actual->task_count == expected->task_count);
+  CHECK(actual->done_count == expected->done_count);
+  CHECK(actual->clean_end == expected->clean_end);
+  CHECK(get_task_position(actual, NULL) == actual->task_count);
+  for (; a && e; a = a->next, e = e->next) {
+    CHECK_STR(a->message, e->message);
+    CHECK(a->done == e->done);
+    CHECK(a->priority == e->priority);
+    CHECK(a->depth == e->depth);
+    CHECK(a->offset == e->offset);
+    CHECK(a->next ? a->next->prev == a : actual->last == a);
+  }
+  CHECK(!a && !e);
+  for (; oa && oe; oa = oa->next, oe = oe->next) {
+    CHECK_STR(oa->key, oe->key);
+    CHECK_STR(oa->value, oe->value);
+  }
+  CHECK(!oa && !oe);
+}
+
+/* Load a file, split into the given number of chunks, and check that it is
+ * the same as a list parsed on a single thread. The messages point into the
+ * image of the file, so none of them are owned by the list. */
+static void check_load(char *filename, size_t chunks, TODOLIST *expected) {
+  LOADER *loader = NULL;
+  TODOLIST *list = start_load(filename, &loader);
+  CHECK(list != NULL);
+  if (!list) {
+    return;
+  }
+  CHECK(finish_load_chunks(loader, chunks));
+  check_same(list, expected);
+  CHECK(list->owned_messages == 0);
+  delete_todolist(list);
+}
+
+int main() {
+  unsigned long state = 1;
+  int splits[FILE_COUNT] = {0, 0, 0};
+  TODOLIST *sequential = NULL;
+  TODOLIST *parallel = NULL;
+  char *filename = temp_file();
+  char *content = NULL;
+  size_t chunks;
+  int kind, lines;
+  for (kind = 0; kind < FILE_COUNT; kind++) {
+    for (lines = 0; lines < 40; lines += 1 + lines / 4) {
+      content = make_file(kind, lines, &state);
+      CHECK(content != NULL);
+      if (!content) {
+        continue;
+      }
+      write_string(filename, content, strlen(content));
+      sequential = parse_todolist_chunks(content, strlen(content), 1);
+      CHECK(sequential != NULL);
+      for (chunks = 2; sequential && chunks <= MAX_CHUNKS; chunks++) {
+        count_splits(content, chunks, splits);
+        parallel = parse_todolist_chunks(content, strlen(content), chunks);
+        CHECK(parallel != NULL);
+        if (parallel) {
+          check_same(parallel, sequential);
+          delete_todolist(parallel);
+        }
+        if (chunks % 7 == 1) {
+          check_load(filename, chunks, sequential);
+        }
+      }
+      if (sequential) {
+        check_load(filename, 1, sequential);
+      }
+      if (sequential) {
+        delete_todolist(sequential);
+      }
+      free(content);
+    }
+  }
+  /* Every kind of file was split at the places it is meant to test. */
+  CHECK(splits[FILE_CRLF] > 0);
+  CHECK(splits[FILE_NO_NEWLINE] > 0);
+  CHECK(splits[FILE_UTF8] > 0);
+  unlink(filename);
+  free(filename);
+  return failures != 0;
+}
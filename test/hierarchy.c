@@ -0,0 +1,195 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that the parents, subtrees and subtask counts of tasks agree with a
+ * walk of the list after random changes, and that the tasks folded by a view
+ * (see view.h) are the subtasks of collapsed tasks. */
+
+#include "test.h"
+#include "task.h"
+#include "view.h"
+
+/* Number of lists that are changed. */
+#define ROUNDS 10
+/* Number of changes made to each list. */
+#define CHANGES 1500
+/* Number of changes between checks. */
+#define CHECK_INTERVAL 3
+
+static const char *words[] = {"call", "Bob", "buy", "milk"};
+
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+static char *random_message(unsigned long *state) {
+  return string_printf("%s %s", words[test_random(state) % WORDS],
+      words[test_random(state) % WORDS]);
+}
+
+/* Find the parent of a task by walking back to a task at a smaller depth. */
+static TASK *walk_to_parent(TASK *task) {
+  TASK *parent = task->prev;
+  while (parent && parent->depth >= task->depth) {
+    parent = parent->prev;
+  }
+  return parent;
+}
+
+/* Find the end of the subtree of a task by walking past its subtasks. */
+static TASK *walk_to_subtree_end(TASK *task) {
+  TASK *end = task->next;
+  while (end && end->depth > task->depth) {
+    end = end->next;
+  }
+  return end;
+}
+
+/* Find the last task of the subtree of a task. */
+static TASK *get_subtree_last(TODOLIST *list, TASK *task) {
+  TASK *end = get_subtree_end(list, task);
+  return end ? end->prev : list->last;
+}
+
+/* Check the hierarchy of a list, and the tasks hidden by a view that hides
+ * done tasks if hide_done is 1. */
+static void check_list(TODOLIST *list, int hide_done) {
+  TASK *task = NULL;
+  TASK *subtask = NULL;
+  TASK *end = NULL;
+  TASK *parent = NULL;
+  size_t count, done, subtasks, subtasks_done;
+  int folded, hidden;
+  for (task = list->first; task; task = task->next) {
+    end = walk_to_subtree_end(task);
+    CHECK(get_parent_task(list, task) == walk_to_parent(task));
+    CHECK(get_subtree_end(list, task) == end);
+    subtasks = 0;
+    subtasks_done = 0;
+    for (subtask = task->next; subtask != end; subtask = subtask->next) {
+      subtasks++;
+      subtasks_done += subtask->done != 0;
+    }
+    count = count_subtasks(list, task, &done);
+    CHECK(count == subtasks && done == subtasks_done);
+    CHECK(find_shallow_task(list, task, task->depth, 1) == end);
+    folded = 0;
+    for (parent = walk_to_parent(task); parent; parent = walk_to_parent(parent)) {
+      folded |= parent->collapsed;
+    }
+    hidden = (hide_done && task->done ? HIDDEN_FILTER : 0)
+      | (folded ? HIDDEN_FOLDED : 0);
+    CHECK(task->hidden == hidden);
+  }
+}
+
+/* Make a random change to a list, or collapse or expand a task. Ranges of
+ * tasks are deleted and moved as whole subtrees. */
+static void random_change(TODOLIST *list, VIEW *view, int *hide_done,
+    unsigned long *state) {
+  size_t count = list->task_count;
+  TASK *task = count ? get_task_at(list, test_random(state) % count) : NULL;
+  TASK *next = count ? get_task_at(list, test_random(state) % count) : NULL;
+  TASK *last = task ? get_subtree_last(list, task) : NULL;
+  TASK *end = task ? last->next : NULL;
+  TASK *subtask = NULL;
+  switch (task ? test_random(state) % 16 : 0) {
+    case 0:
+    case 1:
+      add_task(list, random_message(state), test_random(state) % 2, 0,
+          test_random(state) % 4);
+      break;
+    case 2:
+      insert_task(list, task, random_message(state), test_random(state) % 2,
+          0, test_random(state) % 4);
+      break;
+    case 3:
+      delete_task(task, list);
+      break;
+    case 4:
+      set_task_done(list, task, !task->done);
+      break;
+    case 5:
+      set_task_depth(list, task, test_random(state) % 5);
+      break;
+    case 6:
+      if (next != task) {
+        move_task(list, task, next);
+      }
+      break;
+    case 7:
+      move_task_up(list, task);
+      break;
+    case 8:
+      move_task_down(list, task);
+      break;
+    case 9:
+      if (count > 30) {
+        delete_tasks(list, task, last);
+      }
+      break;
+    case 10:
+      /* The subtree is moved before a task outside of it. */
+      for (subtask = task; subtask != end && subtask != next;
+          subtask = subtask->next) {
+      }
+      if (subtask == end && next != end) {
+        move_tasks(list, task, last, next);
+      }
+      break;
+    case 11:
+      if (test_random(state) % 10 == 0) {
+        delete_done_tasks(list);
+      }
+      break;
+    case 12:
+    case 13:
+      set_task_collapsed(view, list, task, 1);
+      break;
+    case 14:
+      set_task_collapsed(view, list, task, 0);
+      break;
+    case 15:
+      if (test_random(state) % 4 == 0) {
+        *hide_done = !*hide_done;
+        CHECK(set_view_filter(view, list, *hide_done, NULL));
+      }
+      break;
+  }
+}
+
+int main() {
+  unsigned long state = 1;
+  TODOLIST *list = NULL;
+  VIEW *view = NULL;
+  TASK *task = NULL;
+  int hide_done, round, i;
+  for (round = 0; round < ROUNDS; round++) {
+    list = new_todolist(string_printf("Hierarchy test"));
+    for (i = 0; i < 40; i++) {
+      add_task(list, random_message(&state), test_random(&state) % 2, 0,
+          test_random(&state) % 4);
+    }
+    view = open_view(list);
+    CHECK(view != NULL);
+    if (!view) {
+      return 1;
+    }
+    hide_done = 0;
+    for (i = 0; i < CHANGES; i++) {
+      random_change(list, view, &hide_done, &state);
+      if (i % CHECK_INTERVAL == 0) {
+        check_list(list, hide_done);
+      }
+    }
+    check_list(list, hide_done);
+    close_view(view, list);
+    for (task = list->first; task; task = task->next) {
+      CHECK(!task->hidden && !task->collapsed);
+    }
+    CHECK(list->hidden_count == 0);
+    delete_todolist(list);
+  }
+  return failures != 0;
+}
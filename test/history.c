@@ -0,0 +1,166 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that undoing and redoing random changes to a list (see history.h)
+ * restores the list as it was after each step. */
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+#include "history.h"
+
+/* Number of lists that are changed. */
+#define ROUNDS 30
+/* Number of changes, undos and redos made to each list. */
+#define ACTIONS 1000
+
+/* Get a task at a random position, or NULL if the list is empty. */
+static TASK *random_task(TODOLIST *list, unsigned long *state) {
+  return list->task_count ? get_task_at(list,
+      test_random(state) % list->task_count) : NULL;
+}
+
+/* Make a random change to a list. Every change changes how the list is
+ * written, so each step can be compared with the list before and after it. */
+static void random_change(TODOLIST *list, unsigned long *state, int number) {
+  TASK *task = random_task(list, state);
+  TASK *last = NULL;
+  TASK *next = NULL;
+  size_t position, length, count = list->task_count;
+  switch (task ? test_random(state) % 12 : 0) {
+    case 0:
+      add_task(list, string_printf("added %d", number), test_random(state) % 2,
+          test_random(state) % 3, test_random(state) % 3);
+      break;
+    case 1:
+      insert_task(list, task, string_printf("inserted %d", number), 0,
+          test_random(state) % 3, task->depth);
+      break;
+    case 2:
+      delete_task(task, list);
+      break;
+    case 3:
+      next = get_task_at(list, test_random(state) % (count + 1));
+      if (next != task && next != task->next) {
+        move_task(list, task, next);
+      }
+      else {
+        set_task_done(list, task, !task->done);
+      }
+      break;
+    case 4:
+      set_task_done(list, task, !task->done);
+      break;
+    case 5:
+      set_task_priority(list, task, (task->priority + 1) % 4);
+      break;
+    case 6:
+      set_task_message(list, task, string_printf("edited %d%s", number,
+            number % 5 ? "" : " with a longer message than the others"));
+      break;
+    case 7:
+      set_task_depth(list, task, (task->depth + 1) % 4);
+      break;
+    case 8:
+      set_title(list, string_printf("Title %d", number));
+      break;
+    case 9:
+      position = get_task_position(list, task);
+      length = 1 + test_random(state) % 6;
+      if (position + length > count) {
+        length = count - position;
+      }
+      delete_tasks(list, task, get_task_at(list, position + length - 1));
+      break;
+    case 10:
+      position = get_task_position(list, task);
+      length = 1 + test_random(state) % 6;
+      if (position + length > count) {
+        length = count - position;
+      }
+      last = get_task_at(list, position + length - 1);
+      next = get_task_at(list, test_random(state) % (count + 1));
+      if (get_task_position(list, next) >= position
+          && get_task_position(list, next) <= position + length) {
+        set_title(list, string_printf("Title %d", number));
+      }
+      else {
+        move_tasks(list, task, last, next);
+      }
+      break;
+    case 11:
+      set_task_done(list, task, 1);
+      delete_done_tasks(list);
+      break;
+  }
+}
+
+int main() {
+  static char *steps[ACTIONS + 1];
+  unsigned long state = 1;
+  TODOLIST *list = NULL;
+  HISTORY *history = NULL;
+  char *content = NULL;
+  size_t position;
+  int round, action, current, top, limited, undone, i;
+  for (round = 0; round < ROUNDS; round++) {
+    list = new_todolist(string_printf("History test"));
+    /* In some lists, the oldest steps are forgotten. */
+    limited = round % 3 == 0;
+    if (limited) {
+      set_option(list, "undolimit", "3000");
+    }
+    for (i = 0; i < 20; i++) {
+      add_task(list, string_printf("task %d", i), i % 2, i % 4, i % 3);
+    }
+    history = open_history(list);
+    CHECK(history != NULL);
+    if (!history) {
+      return 1;
+    }
+    steps[0] = stringify_todolist(list);
+    current = 0;
+    top = 0;
+    for (action = 0; action < ACTIONS; action++) {
+      switch (test_random(&state) % 6) {
+        case 0:
+          undone = undo_history(history, list, &position);
+          CHECK(undone == (current > 0) || (limited && !undone));
+          if (undone) {
+            current--;
+          }
+          break;
+        case 1:
+          CHECK(redo_history(history, list, &position) == (current < top));
+          if (current < top) {
+            current++;
+          }
+          break;
+        default:
+          /* Some steps consist of more than one change. */
+          next_history_step(history);
+          for (i = test_random(&state) % 4 ? 1 : 3; i > 0; i--) {
+            random_change(list, &state, action);
+          }
+          while (top > current) {
+            free(steps[top--]);
+          }
+          steps[++current] = stringify_todolist(list);
+          top = current;
+          break;
+      }
+      content = stringify_todolist(list);
+      CHECK_STR(content, steps[current]);
+      free(content);
+    }
+    while (top >= 0) {
+      free(steps[top--]);
+    }
+    close_history(history, list);
+    delete_todolist(list);
+  }
+  return failures != 0;
+}
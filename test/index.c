@@ -0,0 +1,265 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that the indexes of a list (see TODOLIST), and the counts of done
+ * tasks in them, agree with a walk of the list after random changes. The
+ * priority order is compared with a stable sort of the list by priority, and
+ * the positions reported to listeners are replayed on an array of tasks. */
+
+#include "test.h"
+#include "task.h"
+
+/* Number of lists that are changed. */
+#define ROUNDS 20
+/* Number of changes made to each list. */
+#define CHANGES 1500
+/* Number of changes between checks. */
+#define CHECK_INTERVAL 7
+
+/* The tasks of a list as reported to a listener. */
+typedef struct SHADOW {
+  TASK **tasks; /* Tasks in list order. */
+  size_t count; /* Number of tasks. */
+} SHADOW;
+
+/* Insert a task into a shadow list, or remove it if task is NULL. */
+static void update_shadow(SHADOW *shadow, size_t position, TASK *task) {
+  CHECK(position <= shadow->count && (task || position < shadow->count));
+  if (task) {
+    memmove(shadow->tasks + position + 1, shadow->tasks + position,
+        (shadow->count - position) * sizeof(TASK *));
+    shadow->tasks[position] = task;
+    shadow->count++;
+  }
+  else if (position < shadow->count) {
+    shadow->count--;
+    memmove(shadow->tasks + position, shadow->tasks + position + 1,
+        (shadow->count - position) * sizeof(TASK *));
+  }
+}
+
+static void record_change(TODOLIST *list, CHANGE *change, void *data) {
+  SHADOW *shadow = (SHADOW *)data;
+  (void)list;
+  switch (change->type) {
+    case CHANGE_INSERT:
+      update_shadow(shadow, change->position, change->task);
+      break;
+    case CHANGE_DELETE:
+      CHECK(shadow->tasks[change->position] == change->task);
+      update_shadow(shadow, change->position, NULL);
+      break;
+    case CHANGE_MOVE:
+      CHECK(shadow->tasks[change->old_position] == change->task);
+      update_shadow(shadow, change->old_position, NULL);
+      update_shadow(shadow, change->position, change->task);
+      break;
+  }
+}
+
+/* Check the links, weights and sizes of a subtree of an index. Returns the
+ * number of tasks in it. */
+static size_t check_tree(TASK *task, TASK *parent, int order) {
+  TASK *left = NULL;
+  TASK *right = NULL;
+  size_t size;
+  if (!task) {
+    return 0;
+  }
+  left = task->node[order].left;
+  right = task->node[order].right;
+  CHECK(task->node[order].parent == parent);
+  CHECK(!parent || parent->weight >= task->weight);
+  size = 1 + check_tree(left, task, order) + check_tree(right, task, order);
+  CHECK(task->node[order].size == size);
+  CHECK(task->node[order].done_size == (task->done != 0)
+      + (left ? left->node[order].done_size : 0)
+      + (right ? right->node[order].done_size : 0));
+  return size;
+}
+
+/* Find the nearest open task after (or before) a position in an array of
+ * tasks. */
+static TASK *walk_to_open_task(TASK **tasks, size_t count, size_t position,
+    int forward) {
+  while (forward ? ++position < count : position-- > 0) {
+    if (!tasks[position]->done) {
+      return tasks[position];
+    }
+  }
+  return NULL;
+}
+
+/* Get the tasks of a list in an order. */
+static TASK **sort_tasks(TODOLIST *list, int order) {
+  TASK **tasks = (TASK **)malloc((list->task_count + 1) * sizeof(TASK *));
+  TASK *task = NULL;
+  size_t count = 0;
+  int priority;
+  if (!tasks) {
+    return NULL;
+  }
+  if (order == ORDER_LIST) {
+    for (task = list->first; task; task = task->next) {
+      tasks[count++] = task;
+    }
+    return tasks;
+  }
+  /* Tasks without a priority come last. */
+  for (priority = PRIORITY_MIN; priority <= PRIORITY_MAX + 1; priority++) {
+    for (task = list->first; task; task = task->next) {
+      if ((task->priority ? task->priority : PRIORITY_MAX + 1) == priority) {
+        tasks[count++] = task;
+      }
+    }
+  }
+  return tasks;
+}
+
+/* Check the positions of the tasks of a list in an order. */
+static void check_order(TODOLIST *list, int order) {
+  TASK **tasks = sort_tasks(list, order);
+  size_t count = list->task_count;
+  size_t position;
+  CHECK(tasks != NULL);
+  if (!tasks) {
+    return;
+  }
+  for (position = 0; position < count; position++) {
+    CHECK(get_ordered_task(list, order, position) == tasks[position]);
+    CHECK(get_ordered_position(list, order, tasks[position]) == position);
+    CHECK(get_next_ordered(list, order, tasks[position])
+        == (position + 1 < count ? tasks[position + 1] : NULL));
+    CHECK(find_open_task(list, order, tasks[position], 1)
+        == walk_to_open_task(tasks, count, position, 1));
+    CHECK(find_open_task(list, order, tasks[position], 0)
+        == walk_to_open_task(tasks, count, position, 0));
+  }
+  CHECK(get_ordered_task(list, order, count) == NULL);
+  CHECK(find_open_task(list, order, NULL, 1)
+      == walk_to_open_task(tasks, count, (size_t)-1, 1));
+  CHECK(find_open_task(list, order, NULL, 0)
+      == walk_to_open_task(tasks, count, count, 0));
+  if (list->indexed[order]) {
+    CHECK(check_tree(list->index_root[order], NULL, order) == count);
+  }
+  free(tasks);
+}
+
+/* Check the positions of the tasks of a list. */
+static void check_list(TODOLIST *list, SHADOW *shadow) {
+  TASK *task = NULL;
+  size_t position = 0;
+  size_t done = 0;
+  int order;
+  CHECK(shadow->count == list->task_count);
+  for (task = list->first; task; task = task->next, position++) {
+    CHECK(position < shadow->count && shadow->tasks[position] == task);
+    CHECK(get_task_at(list, position) == task);
+    CHECK(get_task_position(list, task) == position);
+    CHECK(task->next ? task->next->prev == task : list->last == task);
+    done += task->done != 0;
+  }
+  CHECK(position == list->task_count);
+  CHECK(done == list->done_count);
+  CHECK(get_task_at(list, position) == NULL);
+  CHECK(get_task_position(list, NULL) == position);
+  for (order = 0; order < ORDER_COUNT; order++) {
+    check_order(list, order);
+  }
+}
+
+/* Make a random change to a list. */
+static void random_change(TODOLIST *list, unsigned long *state, int number) {
+  size_t count = list->task_count;
+  TASK *task = count ? get_task_at(list, test_random(state) % count) : NULL;
+  TASK *last = NULL;
+  TASK *next = NULL;
+  size_t position = get_task_position(list, task);
+  size_t length = count ? 1 + test_random(state) % (count - position) : 0;
+  if (task) {
+    last = get_task_at(list, position + length - 1);
+  }
+  switch (task ? test_random(state) % 13 : 0) {
+    case 0:
+    case 1:
+      add_task(list, string_printf("task %d", number),
+          test_random(state) % 2, test_random(state) % 4, 0);
+      break;
+    case 2:
+      insert_task(list, task, string_printf("task %d", number),
+          test_random(state) % 2, test_random(state) % 4, 0);
+      break;
+    case 3:
+      delete_task(task, list);
+      break;
+    case 4:
+      move_task_up(list, task);
+      break;
+    case 5:
+      move_task_down(list, task);
+      break;
+    case 6:
+      next = get_task_at(list, test_random(state) % (count + 1));
+      if (next != task) {
+        move_task(list, task, next);
+      }
+      break;
+    case 7:
+      /* The index is rebuilt when it is next needed. */
+      if (test_random(state) % 20 == 0) {
+        list->indexed[test_random(state) % ORDER_COUNT] = 0;
+      }
+      break;
+    case 8:
+      set_task_done(list, task, !task->done);
+      break;
+    case 9:
+      task = get_ordered_task(list, ORDER_PRIORITY,
+          test_random(state) % count);
+      set_task_priority(list, task, test_random(state) % 4);
+      break;
+    case 10:
+      delete_tasks(list, task, last);
+      break;
+    case 11:
+      /* The tasks are moved before a task outside of the range. */
+      next = get_task_at(list, test_random(state) % (count - length + 1));
+      if (next && get_task_position(list, next) >= position) {
+        next = get_task_at(list, get_task_position(list, next) + length);
+      }
+      move_tasks(list, task, last, next);
+      break;
+    case 12:
+      if (test_random(state) % 10 == 0) {
+        delete_done_tasks(list);
+      }
+      break;
+  }
+}
+
+int main() {
+  static TASK *tasks[CHANGES];
+  unsigned long state = 1;
+  TODOLIST *list = NULL;
+  SHADOW shadow;
+  int round, i;
+  shadow.tasks = tasks;
+  for (round = 0; round < ROUNDS; round++) {
+    list = new_todolist(string_printf("Index test"));
+    shadow.count = 0;
+    add_listener(list, record_change, &shadow);
+    for (i = 0; i < CHANGES; i++) {
+      random_change(list, &state, i);
+      if (i % CHECK_INTERVAL == 0) {
+        check_list(list, &shadow);
+      }
+    }
+    check_list(list, &shadow);
+    delete_todolist(list);
+  }
+  return failures != 0;
+}
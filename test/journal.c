@@ -0,0 +1,82 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that quitting after a save in journal mode, without changing the list
+ * again, doesn't report a failed save, whether or not the result of the first
+ * save has been collected, and that the changes are kept. */
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+#include "journal.h"
+#include "writer.h"
+
+/* Save the journal and wait for it as when quitting. Returns 0 if the save
+ * failed. */
+static int quit_save(JOURNAL *journal, TODOLIST *list) {
+  return save_journal(journal, list) && wait_for_save() != 0;
+}
+
+/* Check that a file with its journal contains the tasks of a list. */
+static void check_saved(TODOLIST *list, char *filename) {
+  TODOLIST *loaded = load_todolist(filename);
+  JOURNAL *journal = loaded ? open_journal(loaded, filename, 1) : NULL;
+  TASK *a = NULL;
+  TASK *e = NULL;
+  CHECK(journal != NULL);
+  if (!journal) {
+    return;
+  }
+  close_journal(journal, loaded);
+  CHECK(loaded->task_count == list->task_count);
+  for (a = loaded->first, e = list->first; a && e; a = a->next, e = e->next) {
+    CHECK_STR(a->message, e->message);
+    CHECK(a->done == e->done);
+  }
+  delete_todolist(loaded);
+}
+
+int main() {
+  char *filename = temp_file();
+  char *journal_filename = string_printf("%s.journal", filename);
+  TODOLIST *list = new_todolist(string_printf("Journal test"));
+  JOURNAL *journal = NULL;
+  add_task(list, string_printf("call Bob"), 0, 0, 0);
+  set_option(list, "journal", "1");
+  CHECK(save_todolist(list, filename));
+  journal = open_journal(list, filename, 1);
+  CHECK(journal != NULL);
+  if (!journal) {
+    return 1;
+  }
+
+  /* Nothing has changed since the list and the journal were saved. */
+  CHECK(save_journal(journal, list));
+  CHECK(wait_for_save() == 1);
+  CHECK(quit_save(journal, list));
+
+  /* The result of the save is collected before quitting. */
+  add_task(list, string_printf("buy milk"), 0, 0, 0);
+  CHECK(save_journal(journal, list));
+  CHECK(wait_for_save() == 1);
+  CHECK(quit_save(journal, list));
+  check_saved(list, filename);
+
+  /* The save is still pending when quitting. */
+  set_task_done(list, list->first, 1);
+  CHECK(save_journal(journal, list));
+  CHECK(quit_save(journal, list));
+  check_saved(list, filename);
+
+  close_journal(journal, list);
+  delete_todolist(list);
+  stop_writer();
+  unlink(journal_filename);
+  unlink(filename);
+  free(journal_filename);
+  free(filename);
+  return failures != 0;
+}
@@ -0,0 +1,164 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that a list saved by rewriting only the changed tail of the file (see
+ * writer.h), or with vectored writes, is written exactly as write_todolist()
+ * writes it. */
+
+#include <sys/stat.h>
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+#include "writer.h"
+
+/* Number of tasks in the list. */
+#define TASKS 400
+/* Number of saves. */
+#define ROUNDS 60
+
+static char *random_message(unsigned long *state) {
+  static const char *words[] = {"buy", "milk", "(B)", "call", "Bob", "ünïcødé",
+    "tab\there", "x", "  spaced"};
+  unsigned long count = test_random(state) % 4;
+  char *message = string_printf("task %lu", test_random(state) % 1000);
+  char *longer = NULL;
+  while (message && count--) {
+    longer = string_printf("%s %s", message, words[test_random(state) % 9]);
+    free(message);
+    message = longer;
+  }
+  return message;
+}
+
+/* Make a random change to a list. Unless anywhere is set, the change is made
+ * to the last quarter of the list, where it can be saved by a patch. */
+static void random_change(TODOLIST *list, unsigned long *state, int anywhere) {
+  size_t count = list->task_count;
+  size_t from = anywhere ? 0 : count - count / 4;
+  size_t position = count > from ? from + test_random(state) % (count - from)
+    : count;
+  TASK *task = get_task_at(list, position);
+  TASK *next = NULL;
+  switch (task ? test_random(state) % 7 : 0) {
+    case 0:
+      if (task) {
+        insert_task(list, task, random_message(state), 0, 0, 0);
+      }
+      else {
+        add_task(list, random_message(state), 0, 0, 0);
+      }
+      break;
+    case 1:
+      delete_task(task, list);
+      break;
+    case 2:
+      next = get_task_at(list, from + test_random(state) % (count - from + 1));
+      if (next != task) {
+        move_task(list, task, next);
+      }
+      break;
+    case 3:
+      set_task_done(list, task, !task->done);
+      break;
+    case 4:
+      set_task_message(list, task, random_message(state));
+      break;
+    case 5:
+      set_task_priority(list, task, test_random(state) % (PRIORITY_MAX + 1));
+      break;
+    case 6:
+      set_task_depth(list, task, test_random(state) % 3);
+      break;
+  }
+}
+
+/* Check that a file contains a list exactly as write_todolist() writes it. */
+static void check_file(TODOLIST *list, const char *filename) {
+  size_t length = 0;
+  char *expected = stringify_todolist(list);
+  char *actual = read_string(filename, &length);
+  CHECK(expected && actual && length == strlen(expected)
+      && memcmp(actual, expected, length) == 0);
+  free(expected);
+  free(actual);
+}
+
+/* Save a list in the background and check the file. Returns 1 if the file was
+ * patched in place rather than replaced. */
+static int save_and_check(TODOLIST *list, const char *filename) {
+  struct stat before, after;
+  CHECK(stat(filename, &before) == 0);
+  CHECK(save_todolist_async(list, filename));
+  CHECK(wait_for_save() == 1);
+  update_file_info(list, filename);
+  CHECK(stat(filename, &after) == 0);
+  check_file(list, filename);
+  return before.st_ino == after.st_ino;
+}
+
+int main() {
+  unsigned long state = 1;
+  char *filename = temp_file();
+  TODOLIST *list = new_todolist(string_printf("Patch test"));
+  TODOLIST *reloaded = NULL;
+  char *expected = NULL;
+  char *actual = NULL;
+  int i, j, patched = 0, replaced = 0;
+  for (i = 0; i < TASKS; i++) {
+    add_task(list, random_message(&state), i % 3 == 0,
+        i % 5 == 0 ? 1 + i % PRIORITY_MAX : 0, i % 4 == 1);
+  }
+  set_option(list, "version", "1.3");
+
+  /* A full save with vectored writes. */
+  CHECK(save_todolist(list, filename));
+  check_file(list, filename);
+  delete_todolist(list);
+
+  /* Task offsets are recorded when the list is loaded. */
+  list = load_todolist(filename);
+  CHECK(list != NULL);
+  if (!list) {
+    return 1;
+  }
+  for (i = 0; i < ROUNDS; i++) {
+    for (j = 1 + test_random(&state) % 5; j > 0; j--) {
+      random_change(list, &state, i % 10 == 9);
+    }
+    if (i % 15 == 7) {
+      set_option(list, "round", i % 2 ? "odd" : "even");
+    }
+    if (save_and_check(list, filename)) {
+      patched++;
+    }
+    else {
+      replaced++;
+    }
+  }
+  /* Both ways of saving were used. */
+  CHECK(patched > 0);
+  CHECK(replaced > 0);
+
+  /* Saving an unchanged list doesn't change the file. */
+  save_and_check(list, filename);
+
+  reloaded = load_todolist(filename);
+  CHECK(reloaded != NULL);
+  if (reloaded) {
+    expected = stringify_todolist(list);
+    actual = stringify_todolist(reloaded);
+    CHECK_STR(actual, expected);
+    free(expected);
+    free(actual);
+    delete_todolist(reloaded);
+  }
+  delete_todolist(list);
+  stop_writer();
+  unlink(filename);
+  free(filename);
+  return failures != 0;
+}
@@ -0,0 +1,173 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that the priorities of tasks are kept when a list is saved and loaded,
+ * directly or through the journal, including for messages without a priority
+ * that start with something that looks like one. */
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+#include "journal.h"
+#include "writer.h"
+
+static const char *messages[] = {
+  "call Bob", "(A) call Bob", "(Z) ", "(A)", "(a) lower case", "(AA) two",
+  "\\(B) escaped", "\\\\(C) escaped twice", "\\no tag", "\\", " (D) spaced",
+  "x (E) later", "(B) (C) two tags"
+};
+
+#define MESSAGES (sizeof(messages) / sizeof(messages[0]))
+
+/* Add each message to a list with and without a priority, at different
+ * depths. */
+static void add_messages(TODOLIST *list) {
+  size_t i;
+  for (i = 0; i < MESSAGES; i++) {
+    add_task(list, string_printf("%s", messages[i]), i % 2, 0, i % 3);
+    add_task(list, string_printf("%s", messages[i]), 0, 1 + i % PRIORITY_MAX,
+        0);
+  }
+}
+
+/* Check that two lists have the same tasks. */
+static void check_same(TODOLIST *actual, TODOLIST *expected) {
+  TASK *a = NULL;
+  TASK *e = NULL;
+  CHECK(actual != NULL);
+  if (!actual) {
+    return;
+  }
+  CHECK(actual->task_count == expected->task_count);
+  for (a = actual->first, e = expected->first; a && e; a = a->next, e = e->next) {
+    CHECK_STR(a->message, e->message);
+    CHECK(a->priority == e->priority);
+    CHECK(a->done == e->done);
+    CHECK(a->depth == e->depth);
+  }
+  CHECK(!a && !e);
+}
+
+/* Check that each task of a list has an offset, i.e. the file is written
+ * exactly as the list would be saved. */
+static void check_offsets(TODOLIST *list) {
+  TASK *task = NULL;
+  for (task = list->first; task; task = task->next) {
+    CHECK(task->offset != NO_OFFSET);
+  }
+}
+
+/* Load a list and replay its journal. */
+static TODOLIST *load_with_journal(char *filename) {
+  TODOLIST *list = load_todolist(filename);
+  JOURNAL *journal = list ? open_journal(list, filename, 1) : NULL;
+  if (journal) {
+    close_journal(journal, list);
+  }
+  return list;
+}
+
+int main() {
+  char *filename = temp_file();
+  char *journal_filename = string_printf("%s.journal", filename);
+  char *content = NULL;
+  TODOLIST *list = new_todolist(string_printf("Priority test"));
+  TODOLIST *loaded = NULL;
+  JOURNAL *journal = NULL;
+  TASK *task = NULL;
+  size_t i;
+  add_messages(list);
+
+  /* Converted to a string and parsed. */
+  content = stringify_todolist(list);
+  CHECK(content != NULL);
+  if (content) {
+    loaded = parse_todolist(content, strlen(content));
+    check_same(loaded, list);
+    if (loaded) {
+      delete_todolist(loaded);
+    }
+    free(content);
+  }
+
+  /* Saved with vectored writes and loaded from the file image. */
+  CHECK(save_todolist(list, filename));
+  loaded = load_todolist(filename);
+  check_same(loaded, list);
+  if (loaded) {
+    check_offsets(loaded);
+    delete_todolist(loaded);
+  }
+
+  /* Saved by patching the end of the file. */
+  delete_todolist(list);
+  list = load_todolist(filename);
+  CHECK(list != NULL);
+  if (!list) {
+    return 1;
+  }
+  for (task = list->last, i = 0; task && i < 4; task = task->prev, i++) {
+    set_task_priority(list, task, 0);
+    set_task_message(list, task, string_printf("%s", messages[i + 1]));
+  }
+  CHECK(save_todolist_async(list, filename));
+  CHECK(wait_for_save() == 1);
+  update_file_info(list, filename);
+  loaded = load_todolist(filename);
+  check_same(loaded, list);
+  if (loaded) {
+    check_offsets(loaded);
+    delete_todolist(loaded);
+  }
+
+  /* Changes recorded in the journal are replayed. */
+  set_option(list, "journal", "1");
+  CHECK(save_todolist(list, filename));
+  journal = open_journal(list, filename, 1);
+  CHECK(journal != NULL);
+  if (!journal) {
+    return 1;
+  }
+  add_messages(list);
+  for (task = list->first; task; task = task->next) {
+    if (task->priority && task->message[0] == '(') {
+      set_task_priority(list, task, 0);
+    }
+  }
+  task = get_task_at(list, 0);
+  set_task_message(list, task, string_printf("(C) edited"));
+  CHECK(save_journal(journal, list));
+  CHECK(wait_for_save() == 1);
+  close_journal(journal, list);
+  loaded = load_with_journal(filename);
+  check_same(loaded, list);
+
+  /* The replayed list is compacted into the file. */
+  if (loaded) {
+    journal = open_journal(loaded, filename, 0);
+    CHECK(journal != NULL);
+    if (journal) {
+      CHECK(save_journal(journal, loaded));
+      CHECK(wait_for_save() == 1);
+      close_journal(journal, loaded);
+    }
+    delete_todolist(loaded);
+  }
+  loaded = load_with_journal(filename);
+  check_same(loaded, list);
+  if (loaded) {
+    check_offsets(loaded);
+    delete_todolist(loaded);
+  }
+
+  delete_todolist(list);
+  stop_writer();
+  unlink(journal_filename);
+  unlink(filename);
+  free(journal_filename);
+  free(filename);
+  return failures != 0;
+}
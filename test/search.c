@@ -0,0 +1,184 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that find_match() finds the same tasks as checking the messages one at
+ * a time, in both orders and in both directions, while the list is changed.
+ * Queries both shorter and longer than a trigram are used, with characters
+ * that are more than one byte in UTF-8. */
+
+#include "test.h"
+#include "task.h"
+#include "search.h"
+
+/* Number of lists that are changed. */
+#define ROUNDS 10
+/* Number of changes made to each list. */
+#define CHANGES 600
+/* Number of queries after each change. */
+#define QUERIES 4
+
+/* Characters of messages and queries. Only the ASCII letters have an upper
+ * case, so a message contains a query if its bytes contain the bytes of the
+ * query after the ASCII letters are converted to lower case. */
+static const char *symbols[] = {
+  "a", "b", "c", "A", "B", "\xc3\xa9", "\xc3\xb8", "\xe6\x97\xa5", " "
+};
+
+#define SYMBOLS (sizeof(symbols) / sizeof(symbols[0]))
+
+/* Make a random string of at most max_length characters. */
+static char *random_text(unsigned long *state, size_t max_length) {
+  char *text = string_printf("%s", "");
+  char *longer = NULL;
+  size_t length = test_random(state) % (max_length + 1);
+  while (text && length-- > 0) {
+    longer = string_printf("%s%s", text, symbols[test_random(state) % SYMBOLS]);
+    free(text);
+    text = longer;
+  }
+  return text;
+}
+
+/* Copy a string with ASCII letters converted to lower case. */
+static char *lower_case(const char *text) {
+  char *copy = string_printf("%s", text);
+  char *c = NULL;
+  for (c = copy; c && *c; c++) {
+    if (*c >= 'A' && *c <= 'Z') {
+      *c += 'a' - 'A';
+    }
+  }
+  return copy;
+}
+
+/* Whether a message contains a query. */
+static int naive_matches(const char *message, const char *query) {
+  char *text = lower_case(message);
+  char *lower = lower_case(query);
+  int matches = strstr(text, lower) != NULL;
+  free(text);
+  free(lower);
+  return matches;
+}
+
+/* Find a match by checking each task next to a task in an order. */
+static TASK *naive_find(TODOLIST *list, int order, const char *query,
+    TASK *task, int forward) {
+  size_t count = list->task_count;
+  size_t start, i;
+  TASK *found = NULL;
+  if (!count) {
+    return NULL;
+  }
+  if (task) {
+    start = get_ordered_position(list, order, task);
+  }
+  else {
+    start = forward ? count - 1 : 0;
+  }
+  for (i = 1; i <= count; i++) {
+    found = get_ordered_task(list, order,
+        forward ? (start + i) % count : (start + count - i) % count);
+    if (naive_matches(found->message, query)) {
+      return found;
+    }
+  }
+  return NULL;
+}
+
+/* Make a random change to a list. */
+static void random_change(TODOLIST *list, unsigned long *state) {
+  size_t count = list->task_count;
+  TASK *task = count ? get_task_at(list, test_random(state) % count) : NULL;
+  TASK *next = NULL;
+  size_t position = get_task_position(list, task);
+  size_t length = count ? 1 + test_random(state) % (count - position) : 0;
+  switch (task ? test_random(state) % 10 : 0) {
+    case 0:
+    case 1:
+      add_task(list, random_text(state, 12), 0, test_random(state) % 4, 0);
+      break;
+    case 2:
+      insert_task(list, task, random_text(state, 12), 0,
+          test_random(state) % 4, 0);
+      break;
+    case 3:
+      delete_task(task, list);
+      break;
+    case 4:
+    case 5:
+      set_task_message(list, task, random_text(state, 12));
+      break;
+    case 6:
+      next = get_task_at(list, test_random(state) % (count + 1));
+      if (next != task) {
+        move_task(list, task, next);
+      }
+      break;
+    case 7:
+      set_task_priority(list, task, test_random(state) % 4);
+      break;
+    case 8:
+      if (length < 5) {
+        delete_tasks(list, task, get_task_at(list, position + length - 1));
+      }
+      break;
+    case 9:
+      if (position + length < count) {
+        move_tasks(list, task, get_task_at(list, position + length - 1), NULL);
+      }
+      break;
+  }
+}
+
+/* Check a random query against each way of finding a match. */
+static void check_query(SEARCH *search, TODOLIST *list, unsigned long *state) {
+  char *query = random_text(state, 5);
+  size_t count = list->task_count;
+  TASK *task = count && test_random(state) % 8 ? get_task_at(list,
+      test_random(state) % count) : NULL;
+  QUERY *folded = new_query(query);
+  int order = test_random(state) % ORDER_COUNT;
+  int forward = test_random(state) % 2;
+  CHECK(find_match(search, list, order, query, task, forward)
+      == naive_find(list, order, query, task, forward));
+  CHECK(folded != NULL);
+  if (folded) {
+    if (task) {
+      CHECK(query_matches(folded, task->message)
+          == naive_matches(task->message, query));
+    }
+    CHECK(query_matches(folded, list->title)
+        == naive_matches(list->title, query));
+    delete_query(folded);
+  }
+  CHECK(text_matches(list->title, query) == naive_matches(list->title, query));
+  free(query);
+}
+
+int main() {
+  unsigned long state = 1;
+  TODOLIST *list = NULL;
+  SEARCH *search = NULL;
+  int round, i, j;
+  for (round = 0; round < ROUNDS; round++) {
+    list = new_todolist(random_text(&state, 8));
+    search = open_search(list);
+    CHECK(search != NULL);
+    if (!search) {
+      return 1;
+    }
+    for (i = 0; i < CHANGES; i++) {
+      random_change(list, &state);
+      for (j = 0; j < QUERIES; j++) {
+        check_query(search, list, &state);
+      }
+    }
+    close_search(search, list);
+    delete_todolist(list);
+  }
+  return failures != 0;
+}
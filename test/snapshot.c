@@ -0,0 +1,149 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that a list loaded from its snapshot (see snapshot.h) is the same as
+ * the list parsed from the file, and that snapshots with invalid task offsets
+ * are rejected. */
+
+#include <stdint.h>
+
+#include "test.h"
+#include "task.h"
+#include "file.h"
+#include "snapshot.h"
+#include "writer.h"
+
+/* Number of tasks, enough for the file to be larger than SNAPSHOT_MIN_SIZE. */
+#define TASKS 40000
+
+/* Offsets in a snapshot of the fields of the header that are changed, and of
+ * the task table, as laid out by snapshot.c. */
+#define HEADER_KEY_SIZE 16
+#define HEADER_CLEAN_END 88
+#define HEADER_SIZE 96
+#define ENTRY_SIZE 16
+
+static uint64_t get_field(const char *data, size_t offset) {
+  uint64_t value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+static void set_field(char *data, size_t offset, uint64_t value) {
+  memcpy(data + offset, &value, sizeof(value));
+}
+
+/* Check that two lists have the same tasks, including their offsets. */
+static void check_same(TODOLIST *actual, TODOLIST *expected) {
+  TASK *a = actual->first;
+  TASK *e = expected->first;
+  CHECK_STR(actual->title, expected->title);
+  CHECK(actual->task_count == expected->task_count);
+  CHECK(actual->clean_end == expected->clean_end);
+  CHECK(actual->file_size == expected->file_size);
+  for (; a && e; a = a->next, e = e->next) {
+    CHECK_STR(a->message, e->message);
+    CHECK(a->done == e->done && a->priority == e->priority
+        && a->depth == e->depth && a->offset == e->offset);
+  }
+  CHECK(!a && !e);
+  CHECK_STR(get_option(actual, "version"), get_option(expected, "version"));
+}
+
+/* Write a copy of a snapshot with a field changed, and check that it is
+ * rejected. */
+static void check_rejected(const char *filename, const char *cache,
+    const char *snapshot, size_t length, size_t offset, uint64_t value) {
+  char *copy = (char *)malloc(length);
+  TODOLIST *list = NULL;
+  CHECK(copy != NULL);
+  if (!copy) {
+    return;
+  }
+  memcpy(copy, snapshot, length);
+  set_field(copy, offset, value);
+  write_string(cache, copy, length);
+  list = load_snapshot(filename);
+  CHECK(list == NULL);
+  if (list) {
+    delete_todolist(list);
+  }
+  free(copy);
+}
+
+int main() {
+  unsigned long state = 1;
+  char *filename = temp_file();
+  char *cache = string_printf("%s.ctodo-cache", filename);
+  char *snapshot = NULL;
+  TODOLIST *list = new_todolist(string_printf("Snapshot test"));
+  TODOLIST *loaded = NULL;
+  size_t length = 0;
+  size_t file_size, task, tasks;
+  int i;
+  for (i = 0; i < TASKS; i++) {
+    add_task(list, string_printf("task %d with a message of some length %lu",
+          i, test_random(&state)), i % 3 == 0, i % 7 == 0 ? 1 + i % 26 : 0,
+        i % 4 == 1);
+  }
+  set_option(list, "version", "1.3");
+  CHECK(save_todolist(list, filename));
+  delete_todolist(list);
+
+  /* Loading a large file writes a snapshot, which is finished once the writer
+   * has stopped. */
+  list = load_todolist(filename);
+  CHECK(list != NULL);
+  stop_writer();
+  if (!list) {
+    return 1;
+  }
+  CHECK(list->file_size >= SNAPSHOT_MIN_SIZE);
+  loaded = load_snapshot(filename);
+  CHECK(loaded != NULL);
+  if (loaded) {
+    check_same(loaded, list);
+    delete_todolist(loaded);
+  }
+
+  snapshot = read_string(cache, &length);
+  CHECK(snapshot != NULL && length > HEADER_SIZE + 3 * ENTRY_SIZE);
+  if (snapshot && length > HEADER_SIZE + 3 * ENTRY_SIZE) {
+    file_size = get_field(snapshot, HEADER_KEY_SIZE);
+    tasks = list->task_count;
+    task = HEADER_SIZE + tasks / 2 * ENTRY_SIZE + 8;
+    /* The clean part of the file ends after the end of the file. */
+    check_rejected(filename, cache, snapshot, length, HEADER_CLEAN_END,
+        file_size + 1);
+    /* A task is after the end of the file. */
+    check_rejected(filename, cache, snapshot, length,
+        HEADER_SIZE + (tasks - 1) * ENTRY_SIZE + 8, file_size);
+    /* A task is at the offset of the task before it. */
+    check_rejected(filename, cache, snapshot, length, task,
+        get_field(snapshot, task - ENTRY_SIZE));
+    /* A task is before the task before it. */
+    check_rejected(filename, cache, snapshot, length, task,
+        get_field(snapshot, task - ENTRY_SIZE) - 1);
+    /* A task has an offset after one that has none. */
+    check_rejected(filename, cache, snapshot, length, task - ENTRY_SIZE,
+        NO_OFFSET);
+
+    /* The unchanged snapshot is still accepted. */
+    write_string(cache, snapshot, length);
+    loaded = load_snapshot(filename);
+    CHECK(loaded != NULL);
+    if (loaded) {
+      delete_todolist(loaded);
+    }
+  }
+  free(snapshot);
+  delete_todolist(list);
+  unlink(cache);
+  unlink(filename);
+  free(cache);
+  free(filename);
+  return failures != 0;
+}
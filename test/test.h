@@ -0,0 +1,100 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Checks shared by the tests. Each test is a program that prints the checks
+ * that failed and exits with a nonzero status if there were any. */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+/* Number of failed checks. */
+static int failures = 0;
+
+/* Check that a condition holds. */
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+          #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+/* Check that two strings are equal. */
+#define CHECK_STR(actual, expected) do { \
+    const char *actual_ = (actual); \
+    const char *expected_ = (expected); \
+    if (!actual_ || !expected_ || strcmp(actual_, expected_) != 0) { \
+      fprintf(stderr, "%s:%d: check failed: %s == \"%s\"\n  got \"%s\"\n", \
+          __FILE__, __LINE__, #actual, expected_ ? expected_ : "(null)", \
+          actual_ ? actual_ : "(null)"); \
+      failures++; \
+    } \
+  } while (0)
+
+/* Next number of a linear congruential generator, so tests that use random
+ * input are repeatable. */
+static inline unsigned long test_random(unsigned long *state) {
+  *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+  return (*state >> 33) & 0x7fffffff;
+}
+
+/* Create an empty temporary file. Returns its name, which must be freed. */
+static inline char *temp_file(void) {
+  const char *dir = getenv("TMPDIR");
+  char *filename = string_printf("%s/ctodo-test-XXXXXX",
+      dir && *dir ? dir : "/tmp");
+  int fd = filename ? mkstemp(filename) : -1;
+  if (fd < 0) {
+    fprintf(stderr, "could not create a temporary file\n");
+    exit(1);
+  }
+  close(fd);
+  return filename;
+}
+
+/* Write a string to a file. */
+static inline void write_string(const char *filename, const char *data,
+    size_t length) {
+  FILE *file = fopen(filename, "wb");
+  if (!file || fwrite(data, 1, length, file) != length) {
+    fprintf(stderr, "could not write %s\n", filename);
+    exit(1);
+  }
+  fclose(file);
+}
+
+/* Read a file into a null-terminated string, which must be freed. Returns
+ * NULL if it can't be read. */
+static inline char *read_string(const char *filename, size_t *length) {
+  FILE *file = fopen(filename, "rb");
+  char *data = NULL;
+  long size = -1;
+  if (!file) {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0
+      && fseek(file, 0, SEEK_SET) == 0) {
+    data = (char *)malloc(size + 1);
+  }
+  if (data && fread(data, 1, size, file) == (size_t)size) {
+    data[size] = '\0';
+    *length = size;
+  }
+  else {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+#endif
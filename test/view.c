@@ -0,0 +1,218 @@
+/* ctodo
+ * Copyright (c) 2016 Niels Sonnich Poulsen (http://nielssp.dk)
+ * Licensed under the MIT license.
+ * See the LICENSE file or http://opensource.org/licenses/MIT for more information.
+ */
+
+/* Tests that the tasks hidden by a view (see view.h) are the ones that don't
+ * pass its filter, and that the shown tasks are found at the same positions as
+ * when skipping the hidden tasks one at a time, in both orders, while the list
+ * and the filter are changed. */
+
+#include <ctype.h>
+
+#include "test.h"
+#include "task.h"
+#include "view.h"
+
+/* Number of lists that are changed. */
+#define ROUNDS 10
+/* Number of changes made to each list. */
+#define CHANGES 1500
+/* Number of changes between checks. */
+#define CHECK_INTERVAL 5
+
+static const char *words[] = {"call", "Bob", "buy", "milk", "write"};
+
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+/* The filter of a view. */
+typedef struct FILTER {
+  int hide_done; /* Whether done tasks are hidden. */
+  const char *query; /* Text that shown tasks contain, or NULL. */
+} FILTER;
+
+static char *random_message(unsigned long *state) {
+  return string_printf("%s %s", words[test_random(state) % WORDS],
+      words[test_random(state) % WORDS]);
+}
+
+/* Whether a task passes a filter. Only ASCII letters are used, so the case is
+ * ignored by converting them to lower case. */
+static int passes(FILTER *filter, TASK *task) {
+  char message[64];
+  char query[64];
+  size_t i;
+  if (filter->hide_done && task->done) {
+    return 0;
+  }
+  if (!filter->query) {
+    return 1;
+  }
+  for (i = 0; task->message[i] && i < sizeof(message) - 1; i++) {
+    message[i] = tolower((unsigned char)task->message[i]);
+  }
+  message[i] = '\0';
+  for (i = 0; filter->query[i] && i < sizeof(query) - 1; i++) {
+    query[i] = tolower((unsigned char)filter->query[i]);
+  }
+  query[i] = '\0';
+  return strstr(message, query) != NULL;
+}
+
+/* Find the nearest shown task after (or before) a position in an array of
+ * tasks. */
+static TASK *walk_to_shown_task(TASK **tasks, size_t count, size_t position,
+    int forward) {
+  while (forward ? ++position < count : position-- > 0) {
+    if (!tasks[position]->hidden) {
+      return tasks[position];
+    }
+  }
+  return NULL;
+}
+
+/* Check the shown tasks of a list in an order. */
+static void check_order(TODOLIST *list, int order) {
+  TASK **tasks = (TASK **)malloc((list->task_count + 1) * sizeof(TASK *));
+  size_t count = list->task_count;
+  size_t position, shown = 0;
+  CHECK(tasks != NULL);
+  if (!tasks) {
+    return;
+  }
+  for (position = 0; position < count; position++) {
+    tasks[position] = get_ordered_task(list, order, position);
+  }
+  for (position = 0; position < count; position++) {
+    CHECK(get_shown_position(list, order, tasks[position]) == shown);
+    if (!tasks[position]->hidden) {
+      CHECK(get_shown_task(list, order, shown) == tasks[position]);
+      shown++;
+    }
+    CHECK(find_shown_task(list, order, tasks[position], 1)
+        == walk_to_shown_task(tasks, count, position, 1));
+    CHECK(find_shown_task(list, order, tasks[position], 0)
+        == walk_to_shown_task(tasks, count, position, 0));
+  }
+  CHECK(get_shown_position(list, order, NULL) == shown);
+  CHECK(get_shown_task(list, order, shown) == NULL);
+  CHECK(find_shown_task(list, order, NULL, 1)
+      == walk_to_shown_task(tasks, count, (size_t)-1, 1));
+  CHECK(find_shown_task(list, order, NULL, 0)
+      == walk_to_shown_task(tasks, count, count, 0));
+  free(tasks);
+}
+
+/* Check that the hidden tasks of a list are the ones that don't pass a
+ * filter. */
+static void check_list(TODOLIST *list, FILTER *filter) {
+  TASK *task = NULL;
+  size_t hidden = 0;
+  size_t hidden_done = 0;
+  int order;
+  for (task = list->first; task; task = task->next) {
+    CHECK(task->hidden == (passes(filter, task) ? 0 : HIDDEN_FILTER));
+    hidden += task->hidden != 0;
+    hidden_done += task->hidden && task->done;
+  }
+  CHECK(list->hidden_count == hidden);
+  CHECK(list->hidden_done_count == hidden_done);
+  for (order = 0; order < ORDER_COUNT; order++) {
+    check_order(list, order);
+  }
+}
+
+/* Make a random change to a list, or to the filter of its view. */
+static void random_change(TODOLIST *list, VIEW *view, FILTER *filter,
+    unsigned long *state) {
+  size_t count = list->task_count;
+  TASK *task = count ? get_task_at(list, test_random(state) % count) : NULL;
+  TASK *next = NULL;
+  size_t position = get_task_position(list, task);
+  size_t length = count ? 1 + test_random(state) % (count - position) : 0;
+  switch (task ? test_random(state) % 12 : 0) {
+    case 0:
+    case 1:
+      add_task(list, random_message(state), test_random(state) % 2,
+          test_random(state) % 4, 0);
+      break;
+    case 2:
+      insert_task(list, task, random_message(state), test_random(state) % 2,
+          test_random(state) % 4, 0);
+      break;
+    case 3:
+      delete_task(task, list);
+      break;
+    case 4:
+    case 5:
+      set_task_done(list, task, !task->done);
+      break;
+    case 6:
+      set_task_message(list, task, random_message(state));
+      break;
+    case 7:
+      set_task_priority(list, task, test_random(state) % 4);
+      break;
+    case 8:
+      next = get_task_at(list, test_random(state) % (count + 1));
+      if (next != task) {
+        move_task(list, task, next);
+      }
+      break;
+    case 9:
+      if (length < 5) {
+        delete_tasks(list, task, get_task_at(list, position + length - 1));
+      }
+      break;
+    case 10:
+      if (position + length < count) {
+        move_tasks(list, task, get_task_at(list, position + length - 1), NULL);
+      }
+      break;
+    case 11:
+      filter->hide_done = test_random(state) % 2;
+      filter->query = test_random(state) % 2 ? NULL
+        : words[test_random(state) % WORDS];
+      CHECK(set_view_filter(view, list, filter->hide_done, filter->query));
+      break;
+  }
+}
+
+int main() {
+  unsigned long state = 1;
+  TODOLIST *list = NULL;
+  VIEW *view = NULL;
+  FILTER filter;
+  TASK *task = NULL;
+  int round, i;
+  for (round = 0; round < ROUNDS; round++) {
+    list = new_todolist(string_printf("View test"));
+    /* Some lists have tasks before the view is opened. */
+    for (i = 0; i < round * 10; i++) {
+      add_task(list, random_message(&state), i % 2, i % 4, 0);
+    }
+    view = open_view(list);
+    CHECK(view != NULL);
+    if (!view) {
+      return 1;
+    }
+    filter.hide_done = 0;
+    filter.query = NULL;
+    check_list(list, &filter);
+    for (i = 0; i < CHANGES; i++) {
+      random_change(list, view, &filter, &state);
+      if (i % CHECK_INTERVAL == 0) {
+        check_list(list, &filter);
+      }
+    }
+    check_list(list, &filter);
+    close_view(view, list);
+    for (task = list->first; task; task = task->next) {
+      CHECK(!task->hidden);
+    }
+    CHECK(list->hidden_count == 0 && list->hidden_done_count == 0);
+    delete_todolist(list);
+  }
+  return failures != 0;
+}